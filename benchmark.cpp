@@ -98,6 +98,7 @@ int main() {
     std::cout << "\n";
 
     set_hash_function();
+    init_psq();
     table.set_size(0x4000000);
     Board board;
     board.reset();
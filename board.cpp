@@ -3,6 +3,8 @@
 #include "misc.hpp"
 #include "transposition.hpp"
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <bitset>
 #include <random>
@@ -22,6 +24,73 @@
          BLACK
 */
 
+int PSQ[4][32];
+
+/* Fills the piece-square table from the piece weights and the king placement weights */
+void init_psq() {
+   for (int sq = 0; sq < 32; sq++) {
+      int king = weights.king;
+      if (S[sq] & CENTER_8) king += weights.king_center;
+      else if (S[sq] & SINGLE_EDGE) king -= weights.king_edge;
+
+      PSQ[BLACK_PIECE][sq] = weights.man;
+      PSQ[WHITE_PIECE][sq] = -weights.man;
+      PSQ[BLACK_KING][sq] = king;
+      PSQ[WHITE_KING][sq] = -king;
+   }
+}
+
+eval_weights weights;
+
+/* The weights by name, in the order they are written out */
+static std::vector<std::pair<std::string, int eval_weights::*>> weight_names = {
+   {"man", &eval_weights::man},
+   {"king", &eval_weights::king},
+   {"king_center", &eval_weights::king_center},
+   {"king_edge", &eval_weights::king_edge},
+   {"mobility", &eval_weights::mobility},
+   {"runaway", &eval_weights::runaway}
+};
+
+/*
+Reads weights written by save. Names that are missing keep their values.
+
+@return
+   false if the file is missing or has a line that isn't a known weight
+*/
+bool eval_weights::load(const char * path) {
+   std::ifstream file(path);
+   if (!file) return false;
+
+   std::string name;
+   int value;
+   while (file >> name >> value) {
+      auto it = std::find_if(weight_names.begin(), weight_names.end(), [&](const auto &w) { return w.first == name; });
+      if (it == weight_names.end()) {
+         std::cout << "Unknown weight " << name << " in " << path << "\n";
+         return false;
+      }
+      this->*(it->second) = value;
+   }
+   std::cout << "Loaded weights " << path << "\n";
+   return true;
+}
+
+bool eval_weights::save(const char * path) const {
+   std::ofstream file(path);
+   for (const auto &w : weight_names) {
+      file << w.first << " " << this->*(w.second) << "\n";
+   }
+   return (bool)file;
+}
+
+void eval_weights::print() const {
+   for (const auto &w : weight_names) {
+      std::cout << w.first << "=" << this->*(w.second) << " ";
+   }
+   std::cout << "\n";
+}
+
 Board::Board() {
    bb.pieces[BLACK] = 0b00000000000000000000111111111111;
    bb.pieces[WHITE] = 0b11111111111100000000000000000000;
@@ -104,6 +173,14 @@ void Board::reset() {
    set_flags();
 }
 
+/* Sets up a position with no moves played before it */
+void Board::set_position(const Bitboards &position) {
+   bb = position;
+   reversible_moves = 0;
+   has_takes = false;
+   set_flags();
+}
+
 /* 
 Calculates a hash key for the board
 
@@ -130,14 +207,50 @@ void Board::set_flags(){
    piece_count[1] = 0;
    king_count[0] = 0;
    king_count[1] = 0;
+   psq_score = 0;
 
    for (int i = 0; i < 32; i++){
       ePieceType pt = bb.piece_on_square(i);
       if (pt != NO_PIECE) {
          piece_count[pt & 1]++;
          if (pt > WHITE_PIECE) king_count[pt & 1]++;
+         psq_score += PSQ[pt][i];
       }
    }
+
+   if (nnue_loaded) nnue_refresh(accumulator, bb.pieces[BLACK], bb.pieces[WHITE], bb.kings);
+}
+
+/*
+Moves the network's hidden sums along with a move
+
+@param move
+   The move being played or undone
+@param kings
+   The king bitboard of the position before the move
+@param undo
+   true if the move is being undone
+*/
+void Board::update_accumulator(const Move &move, uint32_t kings, bool undo) {
+   const int from = nnue_feature(move.piecetype, move.from);
+   const int to = nnue_feature(move.piecetype + 2*move.is_promo, move.to);
+   if (undo) {
+      nnue_add_feature(accumulator, from);
+      nnue_remove_feature(accumulator, to);
+   }
+   else {
+      nnue_remove_feature(accumulator, from);
+      nnue_add_feature(accumulator, to);
+   }
+
+   uint32_t taken = move.taken_bb;
+   while (taken) {
+      uint32_t piece = taken & -taken;
+      int feature = nnue_feature(!move.color() + 2*(!!(piece & kings)), binary_to_square(piece));
+      if (undo) nnue_add_feature(accumulator, feature);
+      else      nnue_remove_feature(accumulator, feature);
+      taken &= taken - 1;
+   }
 }
 
 /*
@@ -153,11 +266,18 @@ void Board::push_move(Move &move) {
    uint8_t piecetype = move.piecetype;
 
    /* Increment the move counter and the counter for consecutive reversible moves */
-   reversible_moves = ((piecetype <= WHITE_PIECE) || (taken)) ? 0 : reversible_moves+1;
+   if ((piecetype <= WHITE_PIECE) || (taken)){
+      resets[reset_count++ & (RESET_HISTORY - 1)] = {reversible_moves, rep_stack[0]};
+      reversible_moves = 0;
+   }
+   else reversible_moves++;
 
    /* Updates the hash key of the board */
    hash_key ^= hash.HASH_COLOR;
    hash_key ^= hash.HASH_FUNCTION[piecetype][from];
+   psq_score -= PSQ[piecetype][from];
+
+   if (nnue_loaded) update_accumulator(move, bb.kings, false);
 
    /* Loop through taken pieces and do all necessary handling */
    while (taken) {
@@ -165,6 +285,7 @@ void Board::push_move(Move &move) {
       uint8_t taken_piecetype = (!bb.stm) + 2*(!!(piece & bb.kings));
 
       hash_key ^= hash.HASH_FUNCTION[taken_piecetype][binary_to_square(piece)]; // Update the board's hash for the removed piece
+      psq_score -= PSQ[taken_piecetype][binary_to_square(piece)];
       piece_count[!bb.stm]--; // Decrement the piece counter
       if (taken_piecetype > WHITE_PIECE) // If the piece was a king, decrement the king counter
          king_count[!bb.stm]--;
@@ -190,11 +311,36 @@ void Board::push_move(Move &move) {
    bb.stm = !bb.stm; // Switch the side to move
 
    hash_key ^= hash.HASH_FUNCTION[piecetype][to]; // Update the board's hash
+   psq_score += PSQ[piecetype][to];
 
    /* Updates the repetition tracker */
    rep_stack[reversible_moves] = hash_key; // Add the hash to the repetition list
 }
 
+/*
+Gives the hash key the board would have after a move, without playing it. Must
+match the key that push_move leaves behind.
+
+@param move
+   The move to be looked at
+@return
+   the hash key of the position after the move
+*/
+uint64_t Board::child_key(const Move &move) const {
+   uint64_t key = hash_key ^ hash.HASH_COLOR ^ hash.HASH_FUNCTION[move.piecetype][move.from];
+
+   uint32_t taken = move.taken_bb;
+   while (taken) {
+      uint32_t piece = taken & -taken;
+      uint8_t taken_piecetype = (!bb.stm) + 2*(!!(piece & bb.kings));
+
+      key ^= hash.HASH_FUNCTION[taken_piecetype][binary_to_square(piece)];
+      taken &= taken - 1;
+   }
+
+   return key ^ hash.HASH_FUNCTION[move.piecetype + 2*move.is_promo][move.to];
+}
+
 /*
 Undoes a move
 
@@ -204,14 +350,22 @@ Undoes a move
    The king bitboard from the previous position
 */
 void Board::undo(Move &move, uint32_t previous_kings) {
-   if (reversible_moves) reversible_moves--;
-
    uint8_t to = move.to;
    uint8_t from = move.from;
 
    uint8_t piecetype = move.piecetype;
+   if ((piecetype <= WHITE_PIECE) || (move.taken_bb)){
+      const reset_entry &reset = resets[--reset_count & (RESET_HISTORY - 1)];
+      reversible_moves = reset.reversible_moves;
+      rep_stack[0] = reset.rep_key;
+   }
+   else if (reversible_moves) reversible_moves--;
+
    hash_key ^= hash.HASH_COLOR;
    hash_key ^= hash.HASH_FUNCTION[piecetype][from];
+   psq_score += PSQ[piecetype][from];
+
+   if (nnue_loaded) update_accumulator(move, previous_kings, true);
 
    uint32_t taken = move.taken_bb;
    while (taken) {
@@ -223,6 +377,7 @@ void Board::undo(Move &move, uint32_t previous_kings) {
       }
 
       hash_key ^= hash.HASH_FUNCTION[taken_piecetype][binary_to_square(piece)];
+      psq_score += PSQ[taken_piecetype][binary_to_square(piece)];
       piece_count[bb.stm]++;
       taken &= taken - 1;
    }
@@ -245,6 +400,7 @@ void Board::undo(Move &move, uint32_t previous_kings) {
    bb.stm = !bb.stm;
 
    hash_key ^= hash.HASH_FUNCTION[piecetype][to];
+   psq_score -= PSQ[piecetype][to];
 }
 
 /*
@@ -538,6 +694,142 @@ int Board::gen_moves(Move * external_movelist, uint8_t tt_move){
    return legal_move_count;
 }
 
+/*
+Generates only the moves that quiescence looks at: every capture when there
+is one, since captures are forced, and otherwise the moves that promote a man.
+
+@param external_movelist
+   array the moves are written to
+@return
+   the number of moves generated
+*/
+int Board::gen_tactical_moves(Move * external_movelist){
+   if (jumpers()) return gen_moves(external_movelist, (char)-1);
+
+   has_takes = false;
+   legal_move_count = 0;
+   movelist = external_movelist;
+   const uint32_t empty = ~(bb.all_pieces());
+   const uint32_t promo = PROMO_MASK[bb.stm] & empty;
+   uint32_t piece, dest;
+
+   if (bb.stm) { // White men on the second rank
+      uint32_t movers = bb.pieces[WHITE] & ~bb.kings & RANK[1];
+      while (movers) {
+         piece = movers & -movers;
+         dest = (piece >> 4) & promo;
+         if (dest)
+            movegen_push(piece, dest, 0, 0);
+         dest = (((piece & MASK_R3) >> 3) | ((piece & MASK_R5) >> 5)) & promo;
+         if (dest)
+            movegen_push(piece, dest, 0, 0);
+         movers &= movers-1;
+      }
+   }
+   else { // Black men on the seventh rank
+      uint32_t movers = bb.pieces[BLACK] & ~bb.kings & RANK[6];
+      while (movers) {
+         piece = movers & -movers;
+         dest = (piece << 4) & promo;
+         if (dest)
+            movegen_push(piece, dest, 0, 0);
+         dest = (((piece & MASK_L3) << 3) | ((piece & MASK_L5) << 5)) & promo;
+         if (dest)
+            movegen_push(piece, dest, 0, 0);
+         movers &= movers-1;
+      }
+   }
+   return legal_move_count;
+}
+
+/*
+Turns a packed move back into a full move for this position. This is a fast pseudo-legality
+check, not a full one: it makes sure the move can be played and undone safely, that captures
+are taken when available, and that quiet moves and single jumps go where the piece can go.
+
+@param packed
+   the move as stored in the transposition table
+@param move
+   filled in with the full move if it passes
+@return
+   false if the move cannot be played in this position
+*/
+bool Board::unpack_move(const packed_move &packed, Move &move) const{
+   if (packed.is_null() || packed.from > 31 || packed.to > 31) return false;
+
+   const uint32_t from = S[packed.from];
+   const uint32_t to = S[packed.to];
+   const uint32_t opponent = bb.pieces[!bb.stm];
+   const bool is_king = from & bb.kings;
+
+   if (!(from & bb.pieces[bb.stm])) return false;
+   if ((to & bb.all_pieces()) && (to != from)) return false;
+
+   /* Rows moved towards promotion, and columns moved */
+   const int from_row = packed.from >> 2, to_row = packed.to >> 2;
+   const int rows = bb.stm ? from_row - to_row : to_row - from_row;
+   const int from_col = 2*(packed.from & 3) + (from_row & 1), to_col = 2*(packed.to & 3) + (to_row & 1);
+   const int captures = count_bits(packed.taken_bb);
+
+   if (!captures) {
+      if (jumpers()) return false; // Captures are mandatory
+      if (abs(to_col - from_col) != 1) return false;
+      if (is_king ? (abs(rows) != 1) : (rows != 1)) return false;
+   }
+   else {
+      if (!(from & jumpers()) || (packed.taken_bb & ~opponent)) return false;
+      if (is_king ? ((rows & 1) || abs(rows) > 2*captures) : (rows != 2*captures)) return false;
+
+      /* A single jump must go straight over the taken piece */
+      if (captures == 1) {
+         if (abs(rows) != 2 || abs(to_col - from_col) != 2) return false;
+         const int mid_row = (from_row + to_row) / 2;
+         const int mid_col = (from_col + to_col) / 2;
+         if (packed.taken_bb != S[mid_row*4 + mid_col/2]) return false;
+      }
+   }
+
+   move.from = packed.from;
+   move.to = packed.to;
+   move.piecetype = bb.stm | (is_king << 1);
+   move.captures = captures;
+   move.taken_bb = packed.taken_bb;
+   move.is_promo = !is_king && (to & PROMO_MASK[bb.stm]);
+   move.score = 0;
+   move.id = (uint8_t)-1;
+   return true;
+}
+
+/*
+Counts the non-capture moves of the side to move without generating them.
+
+@return
+   the number of quiet moves, whether or not captures are available
+*/
+int Board::quiet_move_count() const{
+   const uint32_t empty = ~bb.all_pieces();
+   const uint32_t own = bb.pieces[bb.stm];
+   const uint32_t up = bb.stm ? (own & bb.kings) : own;     // Pieces that can move towards white's side
+   const uint32_t down = bb.stm ? own : (own & bb.kings);   // Pieces that can move towards black's side
+
+   return count_bits((empty >> 4) & up) + count_bits(((empty & MASK_R3) >> 3) & up) + count_bits(((empty & MASK_R5) >> 5) & up)
+        + count_bits((empty << 4) & down) + count_bits(((empty & MASK_L3) << 3) & down) + count_bits(((empty & MASK_L5) << 5) & down);
+}
+
+/*
+Checks if the side to move has exactly one legal move. Quiet positions are counted
+without generating moves, and so are captures by two or more pieces; only a capture
+by a single piece is generated, since its jumps can branch.
+*/
+bool Board::single_move(){
+   const uint32_t can_jump = jumpers();
+   if (!can_jump) return quiet_move_count() == 1;
+   if (can_jump & (can_jump - 1)) return false;
+
+   Move moves[MAX_MOVES];
+   return gen_moves(moves, (char)-1) == 1;
+}
+
 /*
 Get a random move. Note that the random
 seed must be set before this is called.
@@ -557,12 +849,14 @@ Sets the board to a random position by playing "moves_to_play" random moves.
 Note that the random seed must be set before calling this method.
 
 @param moves_to_play
-   How many moves should be played to get to the random position
+   How many moves should be played to get to the random position. Fewer
+   are played if the game ends first.
 */
 void Board::set_random_pos(int moves_to_play){
+   Move arr[MAX_MOVES];
    for (int i = 0; i < moves_to_play; i++){
-      Move m = get_random_move();
-      push_move(m);
+      if (!gen_moves(arr, (char)-1)) return;
+      push_move(arr[rand() % legal_move_count]);
    }
 }
 
@@ -4,6 +4,7 @@
 #pragma once
 
 #include "misc.hpp"
+#include "nnue.hpp"
 
 #include <cstdint>
 #include <cassert>
@@ -53,9 +54,54 @@ const uint32_t RANK[8] = {
 
 const uint32_t PROMO_MASK[2] = {RANK[7], RANK[0]};
 
+/* Kings are worth more in the center and less on the single edges */
+const uint32_t SINGLE_EDGE = S[0] | S[1] | S[2] | S[8] | S[15] | S[16] | S[23] | S[29] | S[30] | S[31];
+const uint32_t CENTER_8 = S[9] | S[10] | S[13] | S[14] | S[17] | S[18] | S[21] | S[22];
+
+#define MAN_VALUE          75
+#define KING_VALUE         100
+#define KING_CENTER_BONUS  10
+#define MOBILITY_VALUE     10
+#define RUNAWAY_VALUE      24
+
+#define WEIGHTS_FILE "checkers.weights"
+
+/*
+Weights of the handcrafted eval. The defaults are the hand picked values; tune fits
+them to game results and writes a file of "name value" lines that load reads back.
+*/
+struct eval_weights{
+   int man = MAN_VALUE;
+   int king = KING_VALUE;
+   int king_center = KING_CENTER_BONUS; // added for kings on CENTER_8
+   int king_edge = KING_CENTER_BONUS;   // taken off kings on SINGLE_EDGE
+   int mobility = MOBILITY_VALUE;       // for each piece only its side can move to where it could go
+   int runaway = RUNAWAY_VALUE;         // for a runaway man, less one for each move it needs to promote
+
+   bool load(const char * path);
+   bool save(const char * path) const;
+   void print() const;
+} extern weights;
+
+/*
+Material and placement value of each piece type on each square, from black's point
+of view. Boards keep the sum over their pieces, so init_psq must be called before
+any are made, and again whenever the weights change.
+*/
+extern int PSQ[4][32];
+void init_psq();
+
 const int DRAW_MOVE_RULE = 50;
 const int REP_LIMIT = 3;
 
+/*
+Captures and man moves that push_move can have to take back at once. From any position
+a line of play has at most 24 * 7 man moves and 24 captures, counting the game before a
+search and the search itself, so no entry is written over before undo needs it, take
+backs included. A power of two, so the index wraps with a mask.
+*/
+const int RESET_HISTORY = 256;
+
 const uint64_t TAKEN_PIECES = (((uint64_t)1 << 32) - 1) << 17;
 
 enum eColor {
@@ -71,6 +117,19 @@ enum ePieceType {
     NO_PIECE
 };
 
+/*
+A move reduced to what identifies it within a position. This is how moves are
+stored in the transposition table; Board::unpack_move turns it back into a Move.
+*/
+struct packed_move {
+    uint32_t taken_bb;
+    uint8_t from;
+    uint8_t to;
+
+    /* Only captures can start and end on the same square */
+    inline bool is_null() const { return from == to && !taken_bb; }
+};
+
 struct Move {
     uint8_t from;
     uint8_t to;
@@ -88,6 +147,10 @@ struct Move {
     inline void set_color(uint8_t color) { piecetype = (piecetype & 2) | color; }
     inline void set_is_king(bool is_king) { piecetype = (piecetype & 1) | (is_king << 1); }
 
+    /* Two moves are the same if they start, end and take in the same places */
+    inline bool same_as(const Move &m) const { return from == m.from && to == m.to && taken_bb == m.taken_bb; }
+    inline packed_move pack() const { return {taken_bb, from, to}; }
+
     void print_move_info();
 };
 
@@ -180,15 +243,27 @@ struct Board {
         Bitboards bb;
         uint8_t piece_count[2];
         uint8_t king_count[2];
+        int psq_score; // Sum of PSQ over the pieces on the board
 
         bool has_takes;
         int reversible_moves;
         uint64_t hash_key;
-        uint64_t rep_stack[DRAW_MOVE_RULE];
+        uint64_t rep_stack[DRAW_MOVE_RULE + 1]; // push_move writes the key of the position that ends the game by the move rule too
+
+        /* What push_move wrote over when a capture or man move reset the count, so that undo can put it back */
+        struct reset_entry{
+            int reversible_moves;
+            uint64_t rep_key;
+        } resets[RESET_HISTORY];
+        unsigned int reset_count = 0;
+
+        /* Hidden layer sums of the network, only kept up to date once one is loaded */
+        alignas(32) int16_t accumulator[NNUE_HIDDEN];
 
         Board();
 
         void reset();
+        void set_position(const Bitboards &position);
         void print();
 
         Move get_random_move();
@@ -196,7 +271,12 @@ struct Board {
 
         void push_move(Move &move);
         void undo(Move &move, uint32_t previous_kings);
+        uint64_t child_key(const Move &move) const;
         int gen_moves(Move * external_movelist, uint8_t tt_move);
+        int gen_tactical_moves(Move * external_movelist);
+        bool unpack_move(const packed_move &packed, Move &move) const;
+        int quiet_move_count() const;
+        bool single_move();
         int check_win() const;
         bool check_repetition() const;
 
@@ -204,6 +284,11 @@ struct Board {
             reversible_moves = 0;
         }
 
+        /* Pieces of the side to move that can capture */
+        inline uint32_t jumpers() const {
+            return bb.stm ? bb.get_white_jumpers() : bb.get_black_jumpers();
+        }
+
     private:
         /* Number of legal moves on the board */
         int legal_move_count;
@@ -215,6 +300,7 @@ struct Board {
 
         void set_flags();
         uint64_t calc_hash_key();
+        void update_accumulator(const Move &move, uint32_t kings, bool undo);
 
         /*
         Returns a score for a piece based on how far it is up the
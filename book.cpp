@@ -0,0 +1,133 @@
+#include "book.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+opening_book book;
+
+/* The hash key of the starting position, which depends only on the hash functions */
+static uint64_t start_key(){
+    Board board;
+    board.reset();
+    return board.hash_key;
+}
+
+/*
+Sorts the entries by key, with the moves of a position from the heaviest down,
+and writes them out.
+
+@return
+   false if the file couldn't be written
+*/
+bool book_write(const std::string &path, std::vector<book_entry> &entries){
+    std::sort(entries.begin(), entries.end(), [](const book_entry &a, const book_entry &b){
+        return a.key != b.key ? a.key < b.key : a.weight > b.weight;
+    });
+
+    FILE * file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    book_header header = {BOOK_MAGIC, sizeof(book_entry), start_key(), entries.size()};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(entries.data(), sizeof(book_entry), entries.size(), file) == entries.size();
+    return fclose(file) == 0 && ok;
+}
+
+opening_book::~opening_book(){
+    close();
+}
+
+void opening_book::close(){
+    if (map) munmap(map, length);
+    map = nullptr;
+    entries = nullptr;
+    length = count = 0;
+}
+
+/*
+Maps a book file written by book_write.
+
+@return
+   false if there is no book, or it doesn't match this build
+*/
+bool opening_book::open(const std::string &path){
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    void * mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(book_header))
+        mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const book_header &header = *(const book_header *)mapped;
+    if (header.magic != BOOK_MAGIC || header.entry_bytes != sizeof(book_entry) || header.start_key != start_key()
+        || header.count > (info.st_size - sizeof(book_header)) / sizeof(book_entry)){
+        munmap(mapped, info.st_size);
+        std::cout << path << " is not an opening book for this version\n";
+        return false;
+    }
+
+    map = mapped;
+    length = info.st_size;
+    entries = (const book_entry *)((const uint8_t *)map + sizeof(book_header));
+    count = header.count;
+
+    std::cout << "Loaded opening book with " << count << " moves from " << path << "\n";
+    return true;
+}
+
+/*
+Finds the moves of a position.
+
+@param first
+   set to the first of them
+@return
+   the number of moves, 0 if the position isn't in the book
+*/
+int opening_book::probe(uint64_t key, const book_entry ** first) const{
+    const book_entry * end = entries + count;
+    const book_entry * found = std::lower_bound(entries, end, key, [](const book_entry &entry, uint64_t key){
+        return entry.key < key;
+    });
+
+    int moves = 0;
+    while (found + moves < end && found[moves].key == key) moves++;
+    *first = found;
+    return moves;
+}
+
+/*
+Picks a book move for the position at random, in proportion to the weights.
+
+@return
+   false if the position has no book moves that can be played
+*/
+bool opening_book::pick(const Board &board, Move &move, book_entry &picked) const{
+    const book_entry * first;
+    const int moves = probe(board.hash_key, &first);
+
+    uint64_t total = 0;
+    for (int i = 0; i < moves; i++) total += first[i].weight;
+    if (!total) return false;
+
+    uint64_t choice = rand() % total;
+    for (int i = 0; i < moves; i++){
+        if (choice < first[i].weight){
+            picked = first[i];
+            return board.unpack_move(picked.move(), move);
+        }
+        choice -= first[i].weight;
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "board.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Opening book. An entry is a move from a position, keyed by the hash of the position,
+with the score a deep search gave it and a weight for how often it is played. The
+file is a header followed by the entries sorted by key, so the moves of a position
+sit next to each other and are found by binary search in the mapped file.
+
+The header keeps the hash of the starting position, so a book made with other hash
+functions is turned down instead of giving moves for the wrong positions.
+*/
+#define BOOK_MAGIC 0x4b4f4f42 // "BOOK"
+#define BOOK_FILE  "checkers.book"
+
+struct book_entry{
+    uint64_t key;
+    uint32_t taken_bb;
+    uint8_t from;
+    uint8_t to;
+    int16_t score;    // from the point of view of the side to move
+    uint32_t weight;  // moves are played in proportion to their weights
+    uint16_t depth;   // of the search that scored the move
+    uint16_t unused;
+
+    inline packed_move move() const { return {taken_bb, from, to}; }
+};
+
+struct book_header{
+    uint32_t magic;
+    uint32_t entry_bytes;
+    uint64_t start_key;
+    uint64_t count;
+};
+
+bool book_write(const std::string &path, std::vector<book_entry> &entries);
+
+class opening_book{
+    public:
+        ~opening_book();
+
+        bool open(const std::string &path);
+        void close();
+        int probe(uint64_t key, const book_entry ** first) const;
+        bool pick(const Board &board, Move &move, book_entry &picked) const;
+
+        inline size_t size() const { return count; }
+
+    private:
+        void * map = nullptr;
+        size_t length = 0;
+        const book_entry * entries = nullptr;
+        size_t count = 0;
+} extern book;
@@ -0,0 +1,149 @@
+#include "cpu.hpp"
+#include "book.hpp"
+#include "board.hpp"
+#include "transposition.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+/*
+Builds the opening book by expanding the tree of openings one ply at a time from
+the starting position. Every position of a ply is searched to a fixed depth for
+its best few moves, the moves that score within the margin of the best go into the
+book, and the positions they lead to make up the next ply. A position reached by
+more than one line is only searched once.
+
+Threads take the positions of a ply from a shared counter. Each has a cpu of its
+own that is cleared before every search, and depth limited searches are repeatable,
+so the book doesn't depend on the number of threads.
+*/
+
+/* Bytes for each table of a book cpu, as in datagen */
+const int BOOK_TABLE_SIZE = 0x2000000;
+
+struct book_settings{
+    int plies;
+    int depth;
+    int moves;    // best moves searched with exact scores at each position
+    int margin;   // how far below the best a move can score and still be played
+};
+
+/*
+Searches a position and adds its book moves. The best move gets a weight of
+margin + 1, and the weight falls by one for every point a move scores below it.
+*/
+void search_position(cpu &player, const Board &board, const book_settings &settings, std::vector<book_entry> &entries){
+    search_limits limits;
+    limits.depth = settings.depth;
+
+    player.clear();
+    player.set_color(board.bb.stm);
+    player.go(board, limits, false);
+
+    const int best = player.lines[0].score;
+    for (int i = 0; i < player.line_count; i++){
+        const pv_line &line = player.lines[i];
+        if (best - line.score > settings.margin) break;
+
+        book_entry entry = {};
+        entry.key = board.hash_key;
+        entry.taken_bb = line.move.taken_bb;
+        entry.from = line.move.from;
+        entry.to = line.move.to;
+        entry.score = std::max(-MAX_VAL, std::min(line.score, MAX_VAL));
+        entry.weight = settings.margin + 1 - (best - line.score);
+        entry.depth = line.depth;
+        entries.push_back(entry);
+    }
+}
+
+int main(){
+    set_hash_function();
+    weights.load(WEIGHTS_FILE);
+    init_psq();
+    nnue_load(NNUE_FILE);
+    egdb.open(EGDB_DIR);
+
+    book_settings settings;
+    std::string path;
+    int threads;
+
+    std::cout << "plies: ";
+    std::cin >> settings.plies;
+    std::cout << "search depth: ";
+    std::cin >> settings.depth;
+    std::cout << "moves searched per position: ";
+    std::cin >> settings.moves;
+    std::cout << "score margin for book moves: ";
+    std::cin >> settings.margin;
+    std::cout << "threads (0 for all cores): ";
+    std::cin >> threads;
+    std::cout << "write book to: ";
+    std::cin >> path;
+    std::cout << "\n";
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    search_options options;
+    options.multi_pv = settings.moves;
+    options.book = false;
+
+    std::vector<std::unique_ptr<cpu>> players;
+    for (int t = 0; t < threads; t++){
+        players.emplace_back(new cpu(BLACK, settings.depth, options));
+        players.back()->table.set_size(BOOK_TABLE_SIZE);
+        players.back()->eval_table.set_size(BOOK_TABLE_SIZE);
+    }
+
+    std::vector<Board> level(1);
+    level[0].reset();
+    std::unordered_set<uint64_t> seen = {level[0].hash_key};
+    std::vector<book_entry> entries;
+    uint64_t start = get_time();
+
+    for (int ply = 0; ply < settings.plies && !level.empty(); ply++){
+        uint64_t ply_start = get_time();
+        std::vector<std::vector<book_entry>> found(level.size());
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+
+        for (int t = 0; t < threads; t++){
+            workers.emplace_back([&, t](){
+                size_t i;
+                while ((i = next++) < level.size()) search_position(*players[t], level[i], settings, found[i]);
+            });
+        }
+        for (std::thread &worker : workers) worker.join();
+
+        /* The next ply is every new position a book move leads to that isn't the end of the game */
+        std::vector<Board> next_level;
+        size_t added = 0;
+        for (size_t i = 0; i < level.size(); i++){
+            for (const book_entry &entry : found[i]){
+                Board board = level[i];
+                Move m, movelist[MAX_MOVES];
+                if (!board.unpack_move(entry.move(), m)) continue;
+
+                entries.push_back(entry);
+                added++;
+                board.push_move(m);
+                if (seen.insert(board.hash_key).second && board.gen_moves(movelist, (char)-1)) next_level.push_back(board);
+            }
+        }
+
+        std::cout << "ply " << ply + 1 << ": " << level.size() << " positions, " << added << " book moves, "
+                  << get_time() - ply_start << " ms\n";
+        level = std::move(next_level);
+    }
+
+    if (!book_write(path, entries)){
+        std::cout << "could not write " << path << "\n";
+        return 1;
+    }
+    std::cout << "\n" << entries.size() << " book moves in " << get_time() - start << " ms, written to " << path << "\n";
+}
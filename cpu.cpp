@@ -12,7 +12,83 @@ https://mediocrechess.blogspot.com/2007/01/guide-aspiration-windows-killer-moves
 
 #include "transposition.hpp"
 
-cpu::cpu(int cpu_color, int cpu_depth){
+/*
+Sets a single option by name. Booleans take 0 or 1.
+
+@return
+   false if there is no option with that name
+*/
+bool search_options::set(const std::string &name, int value){
+    if      (name == "static_prune")         static_prune = value;
+    else if (name == "static_prune_depth")   static_prune_depth = value;
+    else if (name == "static_prune_margin")  static_prune_margin = value;
+    else if (name == "probcut")              probcut = value;
+    else if (name == "probcut_depth")        probcut_depth = value;
+    else if (name == "probcut_reduction")    probcut_reduction = std::max(1, value);
+    else if (name == "probcut_margin")       probcut_margin = value;
+    else if (name == "probcut_slope")        probcut_slope = std::max(1, value);
+    else if (name == "probcut_intercept")    probcut_intercept = value;
+    else if (name == "lmr")                  lmr = value;
+    else if (name == "lmr_min_depth")        lmr_min_depth = value;
+    else if (name == "lmr_min_moves")        lmr_min_moves = value;
+    else if (name == "lmr_late_moves")       lmr_late_moves = value;
+    else if (name == "lmr_cutoff_threshold") lmr_cutoff_threshold = value;
+    else if (name == "lmr_cutoff_bonus")     lmr_cutoff_bonus = value;
+    else if (name == "aspiration")           aspiration = value;
+    else if (name == "aspiration_depth")     aspiration_depth = value;
+    else if (name == "aspiration_window")    aspiration_window = value;
+    else if (name == "aspiration_base")      aspiration_base = value;
+    else if (name == "aspiration_divisor")   aspiration_divisor = value;
+    else if (name == "aspiration_searches")  aspiration_searches = value;
+    else if (name == "mtdf")                 mtdf = value;
+    else if (name == "mtdf_step")            mtdf_step = std::max(1, value);
+    else if (name == "etc")                  etc = value;
+    else if (name == "etc_depth")            etc_depth = value;
+    else if (name == "cont_history")         cont_history = value;
+    else if (name == "countermoves")         countermoves = value;
+    else if (name == "history_malus")        history_malus = value;
+    else if (name == "quiesce_forced_ext")   quiesce_forced_ext = value;
+    else if (name == "forced_chains")        forced_chains = value;
+    else if (name == "quiesce_tt")           quiesce_tt = value;
+    else if (name == "quiesce_max_ply")      quiesce_max_ply = value;
+    else if (name == "quiesce_stand_pat")    quiesce_stand_pat = value;
+    else if (name == "nnue")                 nnue = value;
+    else if (name == "lazy_eval")            lazy_eval = value;
+    else if (name == "egdb")                 egdb = value;
+    else if (name == "book")                 book = value;
+    else if (name == "multi_pv")             multi_pv = std::max(1, std::min(value, MAX_MOVES));
+    else if (name == "threads")              threads = std::max(1, value);
+    else if (name == "split_depth")          split_depth = value;
+    else return false;
+    return true;
+}
+
+void search_options::print() const{
+    std::cout << "static_prune=" << static_prune << " static_prune_depth=" << static_prune_depth
+              << " static_prune_margin=" << static_prune_margin << "\n";
+    std::cout << "probcut=" << probcut << " probcut_depth=" << probcut_depth << " probcut_reduction=" << probcut_reduction
+              << " probcut_margin=" << probcut_margin << " probcut_slope=" << probcut_slope
+              << " probcut_intercept=" << probcut_intercept << "\n";
+    std::cout << "lmr=" << lmr << " lmr_min_depth=" << lmr_min_depth << " lmr_min_moves=" << lmr_min_moves
+              << " lmr_late_moves=" << lmr_late_moves << " lmr_cutoff_threshold=" << lmr_cutoff_threshold
+              << " lmr_cutoff_bonus=" << lmr_cutoff_bonus << "\n";
+    std::cout << "aspiration=" << aspiration << " aspiration_depth=" << aspiration_depth
+              << " aspiration_window=" << aspiration_window << " aspiration_base=" << aspiration_base
+              << " aspiration_divisor=" << aspiration_divisor << " aspiration_searches=" << aspiration_searches << "\n";
+    std::cout << "mtdf=" << mtdf << " mtdf_step=" << mtdf_step << "\n";
+    std::cout << "etc=" << etc << " etc_depth=" << etc_depth << "\n";
+    std::cout << "cont_history=" << cont_history << " countermoves=" << countermoves
+              << " history_malus=" << history_malus << "\n";
+    std::cout << "quiesce_forced_ext=" << quiesce_forced_ext << " forced_chains=" << forced_chains
+              << " multi_pv=" << multi_pv << "\n";
+    std::cout << "quiesce_tt=" << quiesce_tt << " quiesce_max_ply=" << quiesce_max_ply
+              << " quiesce_stand_pat=" << quiesce_stand_pat << "\n";
+    std::cout << "nnue=" << nnue << " lazy_eval=" << lazy_eval << " egdb=" << egdb << " book=" << book << "\n";
+    std::cout << "threads=" << threads << " split_depth=" << split_depth << "\n";
+}
+
+cpu::cpu(int cpu_color, int cpu_depth, search_options opts){
+    options = opts;
     color = cpu_color;
     opponent = 1 - color;
     max_depth = cpu_depth;
@@ -20,6 +96,8 @@ cpu::cpu(int cpu_color, int cpu_depth){
     eval_multiplier = opponent * 2 - 1;
     table.set_size(0x4000000);
     eval_table.set_size(0x4000000);
+    cont_history = new cont_table[2];
+    clear();
     std::cout << "TABLE SIZE: " << table.tt_size << "\n";
     std::cout << "EVAL TABLE SIZE: " << eval_table.ett_size << "\n";
 }
@@ -36,7 +114,13 @@ void cpu::set_depth(int new_depth){
     max_depth = new_depth;
 }
 
-int cpu::mobility_score(Bitboards board) {
+/* changes the search features used by the cpu */
+void cpu::set_options(const search_options &opts){
+    options = opts;
+}
+
+/* The number of pieces black can move to a square white couldn't, less the same for white */
+int cpu::mobility_count(Bitboards board) {
     const uint32_t empty = ~(board.pieces[BLACK] | board.pieces[WHITE]);
     const uint32_t black_kings = board.pieces[BLACK] & board.kings;
     const uint32_t white_kings = board.pieces[WHITE] & board.kings;
@@ -62,10 +146,10 @@ int cpu::mobility_score(Bitboards board) {
     if (white_kings)
         white_result |= ((((unique_white_moves & MASK_R3) >> 3) | ((unique_white_moves & MASK_R5) >> 5)) | (unique_white_moves >> 4)) & white_kings;
 
-    return (count_bits(black_result) - count_bits(white_result)) * 10;
+    return count_bits(black_result) - count_bits(white_result);
 }
 
-int cpu::past_pawns(Bitboards board){
+int cpu::past_pawns(Bitboards board, int runaway_value){
     uint32_t coverage[2] = {northFill(board.pieces[BLACK]), southFill(board.pieces[WHITE])};
     uint32_t king_coverage[2] = {board.pieces[BLACK] & board.kings, board.pieces[WHITE] & board.kings};
     uint32_t paths[2] = {(board.pieces[BLACK] & ~board.kings) & ~coverage[WHITE], (board.pieces[WHITE] & ~board.kings) & ~coverage[BLACK]};
@@ -90,7 +174,7 @@ int cpu::past_pawns(Bitboards board){
             white_distance++;
 
             if (paths[WHITE] & PROMO_MASK[WHITE]){
-                white_score = 24 - white_distance;
+                white_score = runaway_value - white_distance;
                 paths[WHITE] = 0;
             }
             paths[WHITE] &= ~PROMO_MASK[WHITE];
@@ -109,7 +193,7 @@ int cpu::past_pawns(Bitboards board){
             black_distance++;
 
             if (paths[BLACK] & PROMO_MASK[BLACK]){
-                black_score = 24 - black_distance;
+                black_score = runaway_value - black_distance;
                 paths[BLACK] = 0;
             }
             paths[BLACK] &= ~PROMO_MASK[BLACK];
@@ -120,48 +204,158 @@ int cpu::past_pawns(Bitboards board){
     return black_score - white_score;
 }
 
-/* returns the cpu's evaluation of the position */
-int cpu::eval(Board &board){
+/* Dampens a score from black's point of view by how close the game is to a draw, and turns it to the side to move */
+static inline int finish_eval(const Board &board, int result){
+    result *= (1 - (float)board.reversible_moves*(0.02));
+    return board.bb.stm ? -result : result;
+}
+
+/*
+Checks if the terms of the eval still to be added, which together move the score (from
+black's point of view) by at least -below and at most above, can't bring it inside the window.
+*/
+static inline bool lazy_cutoff(const Board &board, int result, int below, int above, int alpha, int beta){
+    int low = finish_eval(board, result - below);
+    int high = finish_eval(board, result + above);
+    if (low > high) std::swap(low, high);
+    return high <= alpha || low >= beta;
+}
+
+/*
+Returns the cpu's evaluation of the position. With lazy eval on, the terms are added
+cheapest first, and once the rest can't bring the score inside (alpha, beta) the
+partial score is returned. It is then only good as a bound, and isn't cached.
+*/
+int cpu::eval(Board &board, int alpha, int beta){
     int probeval = eval_table.probe(board.hash_key);
     if (probeval != INVALID){
         return probeval;
     }
 
-    uint32_t black_kings = board.bb.pieces[BLACK] & board.bb.kings;
-    uint32_t white_kings = board.bb.pieces[WHITE] & board.bb.kings;
+    /*
+    A loaded network replaces all of the handcrafted terms. Its output isn't bounded, so
+    it is clamped below the database wins, which also keeps it out of the mate scores and
+    inside the 16 bit table entries.
+    */
+    if (options.nnue && nnue_loaded){
+        int result = nnue_evaluate(board.accumulator, board.bb.stm);
+        result = std::max(-NNUE_EVAL_MAX, std::min(result, NNUE_EVAL_MAX));
+        result *= (1 - (float)board.reversible_moves*(0.02));
+        eval_table.save(board.hash_key, result);
+        return result;
+    }
 
-    int result = (board.piece_count[BLACK] - board.piece_count[WHITE]) * 75;
-    result    += (board.king_count[BLACK] - board.king_count[WHITE]) * 25;
-    result    += mobility_score(board.bb);
+    const bool men[2] = {board.piece_count[BLACK] != board.king_count[BLACK], board.piece_count[WHITE] != board.king_count[WHITE]};
+    const bool lazy = options.lazy_eval && (alpha > -MAX_VAL || beta < MAX_VAL);
 
-    uint32_t piece;
-    while (black_kings){
-        piece = black_kings & -black_kings;
-        if (piece & CENTER_8) result += 10;
-        else if (piece & SINGLE_EDGE) result -= 10;
-        black_kings &= black_kings-1;
-    }
-    while (white_kings){
-        piece = white_kings & -white_kings;
-        if (piece & CENTER_8) result -= 10;
-        else if (piece & SINGLE_EDGE) result += 10;
-        white_kings &= white_kings-1;
+    /*
+    Bounds on the terms still to come. mobility_count only counts a side's own pieces, so it
+    is between -white pieces and +black pieces. past_pawns gives each side with men either
+    nothing or the runaway weight less 1 to RUNAWAY_MAX_DISTANCE moves.
+    */
+    int pawn_low[2], pawn_high[2];
+    for (int c = 0; c < 2; c++){
+        pawn_low[c] = men[c] ? std::min(0, weights.runaway - RUNAWAY_MAX_DISTANCE) : 0;
+        pawn_high[c] = men[c] ? std::max(0, weights.runaway - 1) : 0;
     }
-
-    if ((board.piece_count[BLACK] != board.king_count[BLACK]) || (board.piece_count[WHITE] != board.king_count[WHITE])){
-        int pawn_score = past_pawns(board.bb);
+    const int pawn_below = pawn_high[WHITE] - pawn_low[BLACK];
+    const int pawn_above = pawn_high[BLACK] - pawn_low[WHITE];
+    const int mobility_below = abs(weights.mobility) * (weights.mobility >= 0 ? board.piece_count[WHITE] : board.piece_count[BLACK]);
+    const int mobility_above = abs(weights.mobility) * (weights.mobility >= 0 ? board.piece_count[BLACK] : board.piece_count[WHITE]);
+
+    /* Material and king placement are kept up to date by the board */
+    int result = board.psq_score;
+    if (lazy && lazy_cutoff(board, result, mobility_below + pawn_below, mobility_above + pawn_above, alpha, beta))
+        return finish_eval(board, result);
+
+    result += weights.mobility * mobility_count(board.bb);
+    if (lazy && lazy_cutoff(board, result, pawn_below, pawn_above, alpha, beta))
+        return finish_eval(board, result);
+
+    if (men[BLACK] || men[WHITE]){
+        int pawn_score = past_pawns(board.bb, weights.runaway);
         result += pawn_score;
     }
-    /* dampen based on how close we are to a draw */
-    result *= (1 - (float)board.reversible_moves*(0.02));
-
-    /* Adjusts the score to be from the perspective of the player whose turn it is */
-    if (board.bb.stm) result = -result;
 
+    result = finish_eval(board, result);
     eval_table.save(board.hash_key, result);
     return result;
 }
 
+/* King moves between two squares */
+static inline int square_distance(int a, int b){
+    int rows = abs((a >> 2) - (b >> 2));
+    int cols = abs((2 * (a & 3) + ((a >> 2) & 1)) - (2 * (b & 3) + ((b >> 2) & 1)));
+    return std::max(rows, cols);
+}
+
+/*
+How far the winner has come in a won database position: the material and king placement
+of the board, less the distance from each of its kings to the nearest piece of the loser.
+All the wins of a position would score the same without it, and the search would have
+no reason to close in.
+*/
+static int egdb_progress(const Board &board, int winner){
+    const Bitboards &bb = board.bb;
+    int progress = winner ? -board.psq_score : board.psq_score;
+
+    uint32_t kings = bb.pieces[winner] & bb.kings;
+    while (kings){
+        const int from = __builtin_ctz(kings);
+        kings &= kings - 1;
+
+        int nearest = 7;
+        uint32_t targets = bb.pieces[!winner];
+        while (targets){
+            nearest = std::min(nearest, square_distance(from, __builtin_ctz(targets)));
+            targets &= targets - 1;
+        }
+        progress -= EGDB_CHASE * nearest;
+    }
+    return std::max(-EGDB_PROGRESS, std::min(progress, EGDB_PROGRESS));
+}
+
+/*
+Looks the position up in the endgame databases. Wins are told apart by egdb_progress,
+so the search heads for the ones that bring the end nearer.
+
+@return
+   the value for the side to move, or INVALID if the position isn't in the databases
+*/
+int cpu::probe_egdb(Board &board){
+    egdb_value value = egdb.probe(board.bb);
+    if (value == EGDB_UNKNOWN) return INVALID;
+
+    egdb_hits++;
+    if (value == EGDB_DRAW) return draw_eval(board);
+    if (value == EGDB_WIN) return EGDB_WIN_VAL + egdb_progress(board, board.bb.stm);
+    return -EGDB_WIN_VAL - egdb_progress(board, !board.bb.stm);
+}
+
+/*
+Keeps the root moves that hold on to the database value of the root: the moves to a
+lost position from a win, and to a drawn one from a draw. A lost root keeps them all.
+
+@return
+   the number of moves kept, at the front of movelist
+*/
+int cpu::egdb_root_moves(Board &board, Move * movelist, int count){
+    const egdb_value value = egdb.probe(board.bb);
+    if (value != EGDB_WIN && value != EGDB_DRAW) return count;
+
+    const egdb_value wanted = value == EGDB_WIN ? EGDB_LOSS : EGDB_DRAW;
+    const uint32_t prev_kings = board.bb.kings;
+    int kept = 0;
+    for (int i = 0; i < count; i++){
+        board.push_move(movelist[i]);
+        const egdb_value reply = board.bb.pieces[board.bb.stm] ? egdb.probe(board.bb) : EGDB_LOSS;
+        board.undo(movelist[i], prev_kings);
+
+        if (reply == wanted) movelist[kept++] = movelist[i];
+    }
+    return kept ? kept : count;
+}
+
 /* Called when search() runs into a draw:
     -Rewards drawing when down in material
     -Punishes drawing when up in material
@@ -175,8 +369,26 @@ Goes through a list of moves and checks if any are killer moves from
 previous iterations. Helps with move ordering.
 */
 void cpu::set_move_scores(Move * m, int movecount, int ply){
+    const Move &prev = move_stack[ply];
+    const packed_move counter = countermoves[prev.from][prev.to];
+    const int16_t (*follow_up[2])[32] = {nullptr, nullptr};
+    if (options.cont_history){
+        follow_up[0] = cont_history[0][prev.from][prev.to];
+        if (ply > 0) follow_up[1] = cont_history[1][move_stack[ply - 1].from][move_stack[ply - 1].to];
+    }
+
     for (int i = 0; i < movecount; i++){
         m[i].score += history[m[i].color()][m[i].from][m[i].to];
+        if (follow_up[0]) m[i].score += follow_up[0][m[i].from][m[i].to];
+        if (follow_up[1]) m[i].score += follow_up[1][m[i].from][m[i].to];
+
+        if (options.countermoves
+        &&  (m[i].from == counter.from)
+        &&  (m[i].to == counter.to)
+        &&  (m[i].score < KILLER_SORT - 2)){
+            m[i].score = KILLER_SORT - 2;
+        }
+
         if ((m[i].from == killers[ply][1].from)
         &&  (m[i].to == killers[ply][1].to)
         &&  (m[i].score < KILLER_SORT - 1)){
@@ -201,23 +413,24 @@ int cpu::search(Board &board, int depth, int ply, int alpha, int beta, int is_pv
 
     int val = -MAX_VAL;
     int mate_value = MAX_VAL - ply;
-    char bestmove;
-    char tt_move_index = (char)-1;
+    packed_move bestmove = {};
+    packed_move tt_move = {};
     char tt_flag = TT_ALPHA;
     int raised_alpha = 0;
-    int reduction_depth = 0;
     int moves_tried = 0;
-    int new_depth;
-    uint32_t prev_kings;
+    Move quiets[MAX_MOVES];
+    int quiet_count = 0;
 
     Move movelist[MAX_MOVES];
     Move current_move;
 
     _mm_prefetch((char *)&table.tt[board.hash_key & table.tt_size], _MM_HINT_NTA);
 
+    if (ply + 1 < MAX_PLY) pv_length[ply + 1] = 0;
+
     /* Cancels the search if time has run out */
     check_time();
-    if (search_cancelled) return 0;
+    if (stopped()) return 0;
 
     /* Mate distance pruning */
     if (alpha < -mate_value) alpha = -mate_value;
@@ -230,7 +443,7 @@ int cpu::search(Board &board, int depth, int ply, int alpha, int beta, int is_pv
     left on the board, to ensure only relatively quiet positions 
     are evaluated.
     */
-    if (depth < 1) return quiesce(board, ply, alpha, beta);
+    if (depth < 1) return quiesce(board, ply, 0, alpha, beta);
 
     /*
     Checks that the current position is not a draw by repetition
@@ -238,11 +451,17 @@ int cpu::search(Board &board, int depth, int ply, int alpha, int beta, int is_pv
     */
     if (board.check_repetition()) return draw_eval(board);
 
+    /* Positions in the endgame databases have exact values, so there is nothing to search */
+    if (board.piece_count[BLACK] + board.piece_count[WHITE] <= egdb_search_pieces){
+        int egdb_val = probe_egdb(board);
+        if (egdb_val != INVALID) return egdb_val;
+    }
+
     /*
     Checks to see if we've searched this position before. If we have, get
     the saved value and return that instead of doing a whole search.
     */
-    if ((val = table.probe(board.hash_key, depth, alpha, beta, &tt_move_index)) != INVALID){
+    if ((val = table.probe(board.hash_key, depth, alpha, beta, &tt_move)) != INVALID){
         if (!is_pv || (val > alpha && val < beta)){
             if (abs(val) > MAX_VAL - 100) {
                 if (val > 0) val -= ply;
@@ -252,100 +471,163 @@ int cpu::search(Board &board, int depth, int ply, int alpha, int beta, int is_pv
         }
     }
 
-    int movecount = board.gen_moves(movelist, tt_move_index);
-    set_move_scores(movelist, movecount, ply);
-    bestmove = movelist[0].id;
-    prev_kings = board.bb.kings;
+    /*
+    Forced chains: a position with only one legal move is not a real decision, so the
+    reply is searched at the same depth, and a chain of forced moves costs one ply in
+    total. The result is saved under this position, so a later visit to any position
+    of the chain is answered from the table without walking it again.
+    */
+    if (options.forced_chains && ply + 1 < MAX_PLY && board.single_move()){
+        uint32_t prev_kings = board.bb.kings;
+        board.gen_moves(movelist, (char)-1);
+        current_move = movelist[0];
+        if (follow_pv && ply + 1 >= prev_pv_length) follow_pv = false;
+
+        move_stack[ply + 1] = current_move;
+        board.push_move(current_move);
+        val = -search(board, depth, ply + 1, -beta, -alpha, is_pv);
+        board.undo(current_move, prev_kings);
+
+        if (stopped()) return 0;
 
-    if (depth < 3
+        if (val >= beta){
+            alpha = beta;
+            tt_flag = TT_BETA;
+        }
+        else if (val > alpha){
+            if (is_pv) update_pv(ply + 1, current_move);
+            alpha = val;
+            tt_flag = TT_EXACT;
+        }
+        table.save(board.hash_key, depth, ply, alpha, tt_flag, current_move.pack());
+        return alpha;
+    }
+
+    if (options.static_prune
+        && depth < options.static_prune_depth
         && !is_pv
-        && !board.has_takes
-        && movecount > 1
+        && !board.jumpers()
+        && board.quiet_move_count() > 1
         && abs(beta - 1) > -MAX_VAL + 100) 
     {
-        int static_eval = eval(board);
-        int eval_margin = 40 * depth;
+        int eval_margin = options.static_prune_margin * depth;
+        int static_eval = eval(board, beta + eval_margin - 1, beta + eval_margin);
         if (static_eval - eval_margin >= beta){
             return static_eval - eval_margin;
         }
     }
 
-    /* Loop through all the moves */
-    for (int i = 0; i < movecount; i++){
-        order_moves(movecount, movelist, i);
-        current_move = movelist[i];
-
-        board.push_move(current_move);
-
-        int start = current_move.from;
-        int end = current_move.to;
-        int color = current_move.color();
-
-        cutoff[color][start][end] -= 1;
-        moves_tried++;
-        reduction_depth = 0;
-        new_depth = depth - 1;
+    /*
+    ProbCut: the value of a shallow search predicts the value of a deep one. When the
+    shallow value is far enough above beta, the deep search would almost always fail
+    high too, so the node is cut. The prediction is deep = slope * shallow + intercept,
+    so the shallow bound is (beta + margin - intercept) / slope, rounded up. The margin
+    decides how often that is wrong. Cutting below alpha as well was tried, and costs
+    more in verification searches than it saves.
+    */
+    if (options.probcut
+        && depth >= options.probcut_depth
+        && !is_pv
+        && !follow_pv
+        && abs(beta) < MAX_VAL - 100)
+    {
+        int shallow_depth = depth - options.probcut_reduction;
+        int scaled = 100 * (beta + options.probcut_margin - options.probcut_intercept);
+        int high = scaled >= 0 ? (scaled + options.probcut_slope - 1) / options.probcut_slope
+                               : -(-scaled / options.probcut_slope);
+        high = std::max(-MAX_VAL + 1, std::min(high, MAX_VAL - 1));
+
+        if (search(board, shallow_depth, ply, high - 1, high, NO_PV) >= high) return beta;
+        if (stopped()) return 0;
+    }
 
-        /* Late Move Reduction */
-        if (!is_pv
-        && new_depth > 3
-        && moves_tried > 1
-        && cutoff[color][start][end] < 50
-        && !current_move.captures
-        && !current_move.is_promo
-        && (start != killers[ply][0].from || end != killers[ply][0].to)
-        && (start != killers[ply][1].from || end != killers[ply][1].to)){
-            cutoff[color][start][end] = 50;
-            reduction_depth = 1;
-            if (moves_tried > 6) reduction_depth += 1;
-            new_depth -= reduction_depth;
+    /*
+    One move is searched before any moves are generated: the move of the previous
+    principal variation while the search is still following it, otherwise the hash
+    move. If it causes a cutoff, the moves are never generated at all.
+    */
+    Move first_move;
+    bool has_first_move = false;
+    if (follow_pv){
+        follow_pv = false;
+        if (ply + 1 < prev_pv_length && board.unpack_move(prev_pv[ply + 1].pack(), first_move)){
+            has_first_move = true;
+            follow_pv = true;
         }
+    }
+    if (!has_first_move) has_first_move = board.unpack_move(tt_move, first_move);
 
-    re_search:
+    int movecount = -1;
 
-        /* Principle Variation Search */
-        if (!raised_alpha){
-            val = -search(board, new_depth, ply + 1, -beta, -alpha, is_pv);
+    /* Loop through all the moves */
+    for (int i = has_first_move ? -1 : 0; ; i++){
+        if (i < 0){
+            current_move = first_move;
         }
         else{
-            if (-search(board, new_depth, ply+1, -alpha - 1, -alpha, NO_PV) > alpha){
-                val = -search(board, new_depth, ply+1, -beta, -alpha, IS_PV);
+            if (movecount < 0){
+                movecount = board.gen_moves(movelist, (char)-1);
+                set_move_scores(movelist, movecount, ply);
+
+                /* The children probe the table as soon as they are searched */
+                if (depth > 1){
+                    for (int j = 0; j < movecount; j++)
+                        _mm_prefetch((char *)&table.tt[board.child_key(movelist[j]) & table.tt_size], _MM_HINT_T0);
+                }
+
+                if (options.etc && !is_pv && depth >= options.etc_depth){
+                    int refutation = probe_children(board, movelist, movecount, depth, beta);
+                    if (refutation >= 0){
+                        etc_cutoffs++;
+                        bestmove = movelist[refutation].pack();
+                        alpha = beta;
+                        tt_flag = TT_BETA;
+                        break;
+                    }
+                }
             }
-        }
+            if (i >= movecount) break;
+
+            /* Young brothers wait: once the first move is searched, idle threads may help with the rest */
+            if (moves_tried && i < movecount - 1 && can_split(depth)){
+                val = split(board, movelist + i, movecount - i, has_first_move ? &first_move : nullptr,
+                            depth, ply, alpha, beta, is_pv, moves_tried, raised_alpha, bestmove);
+                if (stopped()) return 0;
 
+                if (val >= beta){
+                    alpha = beta;
+                    tt_flag = TT_BETA;
+                }
+                else if (val > alpha){
+                    alpha = val;
+                    tt_flag = TT_EXACT;
+                }
+                break;
+            }
 
-        if (reduction_depth && val > alpha){
-            new_depth += reduction_depth;
-            reduction_depth = 0;
-            goto re_search;
+            order_moves(movecount, movelist, i);
+            current_move = movelist[i];
+            if (has_first_move && current_move.same_as(first_move)) continue;
         }
 
-        board.undo(current_move, prev_kings);
+        moves_tried++;
+        val = search_move(board, current_move, depth, ply, alpha, beta, is_pv, moves_tried, raised_alpha);
+        follow_pv = false;
 
-        if (search_cancelled) return 0;
+        if (stopped()) return 0;
 
-        if (val > alpha){
-            bestmove = movelist[i].id;
-            cutoff[color][start][end] += 6;
-            if (val >= beta){
+        if (!current_move.captures && !current_move.is_promo && quiet_count < MAX_MOVES)
+            quiets[quiet_count++] = current_move;
 
-                /*
-                If we encounter a good move, we save it as a "killer" move. Then, in future searches,
-                we can evaluate these moves first, which massively improves the efficiency of the search.
-                */
-                if (!current_move.captures && !current_move.is_promo){
-                    set_killers(current_move, ply);
-                    history[color][start][end] += depth*depth;
-
-                    if (history[current_move.color()][start][end] > KILLER_SORT){
-                        for (int cl = 0; cl < 2; cl++)
-                            for (int a = 0; a < 32; a++)
-                                for (int b = 0; b < 32; b++){
-                                    history[cl][a][b] = history[cl][a][b] / 2;
-                                }
-                    }
-                }
+        /* Without a better move, the first one searched is kept as the hash move */
+        if (moves_tried == 1) bestmove = current_move.pack();
 
+        if (val > alpha){
+            bestmove = current_move.pack();
+            if (is_pv) update_pv(ply + 1, current_move);
+            cutoff[current_move.color()][current_move.from][current_move.to] += options.lmr_cutoff_bonus;
+            if (val >= beta){
+                record_cutoff(current_move, depth, ply, quiets, quiet_count - 1);
                 alpha = beta;
                 tt_flag = TT_BETA;
                 break; /* We have encountered a move so good that there is no point in searching further. */
@@ -361,92 +643,281 @@ int cpu::search(Board &board, int depth, int ply, int alpha, int beta, int is_pv
     whose turn it is to play is the loser.
     */
     if (!movecount){
-        bestmove = -1;
         alpha = -MAX_VAL + ply;
     }
 
     /* If we haven't run out of time, save the position in our transposition table */
-    if (!search_cancelled) table.save(board.hash_key, depth, ply, alpha, tt_flag, bestmove);
+    if (!stopped()) table.save(board.hash_key, depth, ply, alpha, tt_flag, bestmove);
 
     return alpha;
 }
 
+/*
+Plays a move, searches it with late move reductions and principal variation
+search, then takes it back. Used for every move of search(), both by the thread
+that owns the node and by the threads helping at a split point.
+
+@param moves_tried
+   number of moves searched at the node, counting this one
+@param raised_alpha
+   whether a move before this one raised alpha, so that a null window is enough
+*/
+int cpu::search_move(Board &board, const Move &m, int depth, int ply, int alpha, int beta, int is_pv,
+                     int moves_tried, int raised_alpha){
+    Move current_move = m;
+    uint32_t prev_kings = board.bb.kings;
+    int start = current_move.from;
+    int end = current_move.to;
+    int color = current_move.color();
+    int reduction_depth = 0;
+    int new_depth = depth - 1;
+    int val;
+
+    board.push_move(current_move);
+    cutoff[color][start][end] -= 1;
+    move_stack[ply + 1] = current_move;
+
+    /* Late Move Reduction */
+    if (options.lmr
+    && !is_pv
+    && new_depth > options.lmr_min_depth
+    && moves_tried > options.lmr_min_moves
+    && cutoff[color][start][end] < options.lmr_cutoff_threshold
+    && !current_move.captures
+    && !current_move.is_promo
+    && (start != killers[ply][0].from || end != killers[ply][0].to)
+    && (start != killers[ply][1].from || end != killers[ply][1].to)){
+        cutoff[color][start][end] = options.lmr_cutoff_threshold;
+        reduction_depth = 1;
+        if (moves_tried > options.lmr_late_moves) reduction_depth += 1;
+        new_depth -= reduction_depth;
+    }
+
+re_search:
+
+    /* Principle Variation Search */
+    if (!raised_alpha){
+        val = -search(board, new_depth, ply + 1, -beta, -alpha, is_pv);
+    }
+    else{
+        val = -search(board, new_depth, ply+1, -alpha - 1, -alpha, NO_PV);
+        if (val > alpha){
+            val = -search(board, new_depth, ply+1, -beta, -alpha, IS_PV);
+        }
+    }
+
+    if (reduction_depth && val > alpha){
+        new_depth += reduction_depth;
+        reduction_depth = 0;
+        goto re_search;
+    }
+
+    board.undo(current_move, prev_kings);
+    return val;
+}
+
+/*
+Enhanced transposition cutoffs. Looks up the position after every move in the table,
+and if one of them is already known to be worth at least beta to this side, the node
+can be cut without searching anything. Mate scores are left alone, because the table
+stores them relative to a ply that the child has not been searched at.
+
+@return
+   the index of the move that refutes the node, or -1 if there is none
+*/
+int cpu::probe_children(Board &board, Move * movelist, int movecount, int depth, int beta){
+    packed_move unused;
+
+    for (int i = 0; i < movecount; i++){
+        int val = table.probe(board.child_key(movelist[i]), depth - 1, -beta, -beta + 1, &unused);
+        if (val != INVALID && abs(val) < MAX_VAL - 100 && -val >= beta) return i;
+    }
+    return -1;
+}
+
+/*
+If we encounter a good move, we save it as a "killer" move. Then, in future searches,
+we can evaluate these moves first, which massively improves the efficiency of the search.
+The quiet moves searched before it at the node did not cut, so their scores go down.
+
+@param quiets
+   the quiet moves searched before the move that cut
+*/
+void cpu::record_cutoff(const Move &m, int depth, int ply, const Move * quiets, int quiet_count){
+    if (m.captures || m.is_promo) return;
+
+    const Move &prev = move_stack[ply];
+    int bonus = std::min(depth*depth, HISTORY_BONUS_MAX);
+
+    set_killers(m, ply);
+    countermoves[prev.from][prev.to] = m.pack();
+
+    update_quiet_history(m, ply, bonus);
+    if (options.history_malus)
+        for (int i = 0; i < quiet_count; i++) update_quiet_history(quiets[i], ply, -bonus);
+}
+
+/* Moves the butterfly and continuation history scores of a quiet move */
+void cpu::update_quiet_history(const Move &m, int ply, int bonus){
+    const Move &prev = move_stack[ply];
+
+    update_history(history[m.color()][m.from][m.to], bonus);
+    update_history(cont_history[0][prev.from][prev.to][m.from][m.to], bonus);
+    if (ply > 0){
+        const Move &prev2 = move_stack[ply - 1];
+        update_history(cont_history[1][prev2.from][prev2.to][m.from][m.to], bonus);
+    }
+}
+
 /* Searches until a quiet position is found. In this case, that means
    that the search will continue until there are no takes or promotions
    available on the board. This usually ensures that long exchanges of
    pieces are calculated all the way through.*/
-int cpu::quiesce(Board &board, int ply, int alpha, int beta){
+int cpu::quiesce(Board &board, int ply, int qply, int alpha, int beta){
     nodes_traversed++;
+    quiesce_nodes++;
 
     check_time();
-    if (search_cancelled) return 0;
+    if (stopped()) return 0;
     if (board.check_repetition()) return draw_eval(board);
 
-    /* Generate legal moves*/
+    if (in_egdb_range(board)){
+        int egdb_val = probe_egdb(board);
+        if (egdb_val != INVALID) return egdb_val;
+    }
+
+    /* Very long capture sequences are cut off and evaluated as they stand */
+    if (qply >= options.quiesce_max_ply) return eval(board);
+
+    /*
+    The same exchanges come up again and again in sibling subtrees. Their values are
+    kept in the table at depth 0, so they never replace the result of a real search,
+    while a real search result of the position is always good enough here.
+    */
+    packed_move tt_move = {};
+    if (options.quiesce_tt || options.forced_chains){
+        int val = table.probe(board.hash_key, 0, alpha, beta, &tt_move);
+        if (val != INVALID){
+            if (abs(val) > MAX_VAL - 100){
+                if (val > 0) val -= ply;
+                else         val += ply;
+            }
+            return val;
+        }
+    }
+
+    /*
+    Only captures and promotions are generated. The quiet moves are counted instead,
+    to find the end of the game and single replies, and only generated for the latter.
+    */
     Move movelist[MAX_MOVES];
-    int movecount = board.gen_moves(movelist, (char)-1);
     uint32_t prev_kings = board.bb.kings;
+    const bool capture = board.jumpers();
+    int movecount;
+    bool forced;
+    if (capture){
+        movecount = board.gen_tactical_moves(movelist);
+        forced = movecount == 1;
+    }
+    else{
+        int quiet_count = board.quiet_move_count();
 
-    /* Check if the game is over */
-    if (!movecount){
-        return -MAX_VAL + ply;
+        /* Check if the game is over */
+        if (!quiet_count) return -MAX_VAL + ply;
+
+        forced = quiet_count == 1;
+        movecount = (forced && options.quiesce_forced_ext) ? board.gen_moves(movelist, (char)-1)
+                                                           : board.gen_tactical_moves(movelist);
     }
 
     /* Never end on a position where there is a forced move */
-    else if (movecount == 1){
+    if (forced && options.quiesce_forced_ext){
         board.push_move(movelist[0]);
-        int val = -quiesce(board, ply + 1, -beta, -alpha);
+        int val = -quiesce(board, ply + 1, qply + 1, -beta, -alpha);
         board.undo(movelist[0], prev_kings);
+        if (stopped()) return 0;
+
+        if (options.quiesce_tt || options.forced_chains){
+            char flag = (val <= alpha) ? TT_ALPHA : (val >= beta) ? TT_BETA : TT_EXACT;
+            table.save(board.hash_key, 0, ply, val, flag, movelist[0].pack());
+        }
         return val;
     }
 
-    /* Get an evaluation of the current position.*/
-    int val = eval(board);
+    char tt_flag = TT_ALPHA;
+    packed_move bestmove = {};
 
-    /* Check if the evaluation causes a beta cutoff */
-    if (val >= beta) return beta;
+    /* A capture can't be declined, so normally the position is only evaluated when there is none */
+    if (!capture || options.quiesce_stand_pat){
+        int val = eval(board, alpha, beta);
+
+        /* Check if the evaluation causes a beta cutoff */
+        if (val >= beta) return beta;
+
+        /* Check if the evaluation becomes the new alpha */
+        if (alpha < val){
+            alpha = val;
+            tt_flag = TT_EXACT;
+        }
+    }
 
-    /* Check if the evaluation becomes the new alpha */
-    if (alpha < val) alpha = val;
+    Move hash_move;
+    if (board.unpack_move(tt_move, hash_move)){
+        for (int i = 0; i < movecount; i++)
+            if (movelist[i].same_as(hash_move)) movelist[i].score = HASH_SORT;
+    }
 
     for (int i = 0; i < movecount; i++){
         order_moves(movecount, movelist, i);
 
-        /* If the current move is not a take or a promotion, we do not worry about it */
-        if (!(movelist[i].captures || movelist[i].is_promo)) continue;
-
         board.push_move(movelist[i]);
 
-        val = -quiesce(board, ply + 1, -beta, -alpha);
+        int val = -quiesce(board, ply + 1, qply + 1, -beta, -alpha);
 
         board.undo(movelist[i], prev_kings);
 
-        if (search_cancelled) return 0;
+        if (stopped()) return 0;
 
         if (val > alpha){
-            if (val >= beta) return beta;
+            bestmove = movelist[i].pack();
+            if (val >= beta){
+                alpha = beta;
+                tt_flag = TT_BETA;
+                break;
+            }
             alpha = val;
+            tt_flag = TT_EXACT;
         }
     }
+
+    if (options.quiesce_tt) table.save(board.hash_key, 0, ply, alpha, tt_flag, bestmove);
     return alpha;
 }
 
 /* Search the lowest level of the game tree */
 int cpu::search_root(Board &board, int depth, int alpha, int beta){
-    Move movelist[MAX_MOVES];
-    int movecount = board.gen_moves(movelist, bestmove);
     int val = 0;
     int best = -MAX_VAL;
+    packed_move best_packed = {};
     uint32_t prev_kings = board.bb.kings;
 
-    for (int i = 0; i < movecount; i++){
+    root_passes++;
+    pv_length[0] = 0;
 
-        /* Puts the current best move at the front of the movelist */
-        order_moves(movecount, movelist, i);
+    /* The previous principal variation is only followed if its move is searched first */
+    if (follow_pv) follow_pv = prev_pv_length > 0 && root_to_front(prev_pv[0]);
 
-        board.push_move(movelist[i]);
+    for (int i = 0; i < root_move_count; i++){
+        Move current_move = root_moves[i].move;
+
+        /* Skips moves already reported as better lines in Multi-PV mode */
+        if (root_excluded & (1u << current_move.id)) continue;
 
-        cutoff[movelist[i].color()][movelist[i].from][movelist[i].to] -= 1;
+        uint64_t start_nodes = total_nodes();
+        board.push_move(current_move);
+
+        cutoff[current_move.color()][current_move.from][current_move.to] -= 1;
+        move_stack[0] = current_move;
 
         /*Principle Variation Search*
 
@@ -455,22 +926,25 @@ int cpu::search_root(Board &board, int depth, int alpha, int beta){
         Note: Move ordering must be very good for this to be effective.
         */
         if (best == -MAX_VAL){
-            val = -search(board, depth - 1, 0, -beta, -alpha, IS_PV);
+            val = -search(board, depth - 1, 0, -beta, -alpha, (beta - alpha > 1) ? IS_PV : NO_PV);
         }
         else{
             /* If we're not looking at the first move, we search with a reduced window.*/
-            if (-search(board, depth - 1, 0, -alpha - 1, -alpha, NO_PV) > alpha){
-
-                /*
-                If for some reason this search yields a value better than what we already have,
-                we can no longer assume that the first move was the best one, so we must search again
-                with the full window.
-                */
+            val = -search(board, depth - 1, 0, -alpha - 1, -alpha, NO_PV);
+
+            /*
+            If for some reason this search yields a value better than what we already have,
+            we can no longer assume that the first move was the best one, so we must search again
+            with the full window. A null window root search (MTD(f)) already has its answer.
+            */
+            if (val > alpha && beta - alpha > 1){
                 val = -search(board, depth - 1, 0, -beta, -alpha, IS_PV);
             }
         }
 
-        board.undo(movelist[i], prev_kings);
+        board.undo(current_move, prev_kings);
+        follow_pv = false;
+        root_moves[i].nodes += total_nodes() - start_nodes;
 
         if (val > best) best = val;
 
@@ -481,33 +955,48 @@ int cpu::search_root(Board &board, int depth, int alpha, int beta){
         if (search_cancelled) break;
 
         if (val > alpha){
-            /* Update the best move */
-            bestmove = movelist[i].id;
-            move_to_make = movelist[i];
-            if (val > beta){
-                table.save(board.hash_key, depth, -1, beta, TT_BETA, bestmove);
+            /* Update the best move, and move it to the front so that the next pass starts with it */
+            root_moves[i].score = val;
+            std::rotate(root_moves, root_moves + i, root_moves + i + 1);
+            best_packed = current_move.pack();
+            move_to_make = current_move;
+            update_pv(0, current_move);
+            /* With moves excluded, the score is not the value of the position, so it isn't saved */
+            if (val >= beta){
+                if (!root_excluded) table.save(board.hash_key, depth, -1, beta, TT_BETA, best_packed);
                 return beta;
             }
 
-            table.save(board.hash_key, depth, -1, alpha, TT_ALPHA, bestmove);
+            if (!root_excluded) table.save(board.hash_key, depth, -1, alpha, TT_ALPHA, best_packed);
             alpha = val;
         }
     }
 
-    if (!search_cancelled)
-        table.save(board.hash_key, depth, -1, alpha, TT_EXACT, bestmove);
+    if (!search_cancelled && !root_excluded)
+        table.save(board.hash_key, depth, -1, alpha, TT_EXACT, best_packed);
 
     return alpha;
 }
 
+/* Searches the root to the depth with the driver chosen in the options, starting from a guess of the score */
+int cpu::search_driver(Board &board, int depth, int guess){
+    root_iterations++;
+    if (depth == 1)   return search_root(board, 1, -MAX_VAL, MAX_VAL);
+    if (options.mtdf) return search_mtdf(board, depth, guess);
+    return search_widen(board, depth, guess);
+}
+
 /* Handles narrowing the aspiration window */
 int cpu::search_widen(Board &board, int depth, int val){
     int temp = val;
     int searches = 0;
-    const int max_searches = 3;
+    const int max_searches = options.aspiration_searches;
+
+    if (!options.aspiration) return search_root(board, depth, -MAX_VAL, MAX_VAL);
 
     /* Narrow the search window, using the last search's value as a basis. */
-    int window = (depth < 8) ? 50 : (20 + abs(val) / 8);
+    int window = (depth < options.aspiration_depth) ? options.aspiration_window
+                                                    : (options.aspiration_base + abs(val) / options.aspiration_divisor);
     int alpha  = val - window;
     int beta   = val + window;
 
@@ -533,23 +1022,246 @@ int cpu::search_widen(Board &board, int depth, int val){
     return temp;
 }
 
-int cpu::search_iterate(Board &board){
-    int val;
+/*
+MTD(f): every pass is a null window search_root call that only tells whether the
+score is at least a test value, and the bounds close in on the score. The search
+is fail-hard, so a pass never gives a tighter bound than the test value itself.
+The test value steps away from the guess, doubling the step after every miss,
+until the score is bracketed, and then the bracket is halved until it closes.
+*/
+int cpu::search_mtdf(Board &board, int depth, int guess){
+    int lower = -MAX_VAL;
+    int upper = MAX_VAL;
+    int step = options.mtdf_step;
+    int test = guess;
+
+    while (lower < upper){
+        test = std::max(lower + 1, std::min(test, upper));
+
+        if (search_root(board, depth, test - 1, test) >= test) lower = test;
+        else                                                    upper = test - 1;
+
+        if (search_cancelled) return guess;
+
+        if (lower > -MAX_VAL && upper < MAX_VAL) test = (lower + upper + 1) / 2;
+        else if (lower > -MAX_VAL)               test = lower + step;
+        else                                     test = upper + 1 - step;
+        step *= 2;
+    }
+
+    return lower;
+}
+
+/*
+Searches one iteration, finding the best options.multi_pv root moves. Each line
+after the first is searched with the moves of the lines before it excluded, so
+the table and the move ordering from the earlier lines are shared.
+
+@return
+   the score of the best line
+*/
+int cpu::search_lines(Board &board, int depth, int val){
+    int lines_wanted = std::min(options.multi_pv, root_move_count);
+
+    sort_root_moves();
+
+    if (lines_wanted <= 1){
+        if (line_count) load_prev_pv(lines[0]);
+        val = search_driver(board, depth, val);
+        if (!search_cancelled){
+            store_line(board, lines[0], val, depth);
+            line_count = 1;
+        }
+        return val;
+    }
+
+    pv_line found[MAX_MOVES];
+    int found_count = 0;
+
+    for (int k = 0; k < lines_wanted; k++){
+        /* Each line starts from where it was in the last iteration */
+        int guess = (k < line_count) ? lines[k].score : val;
+        if (k < line_count) load_prev_pv(lines[k]);
+
+        int score = search_driver(board, depth, guess);
+        if (search_cancelled) break;
+
+        store_line(board, found[found_count++], score, depth);
+        root_excluded |= 1u << move_to_make.id;
+    }
+    root_excluded = 0;
+
+    if (!found_count) return val;
+
+    /* A later line can come out better than an earlier one when the earlier search failed high */
+    std::stable_sort(found, found + found_count, [](const pv_line &a, const pv_line &b){ return a.score > b.score; });
+
+    /* A cut short iteration still decides the best move, but keeps the old lines */
+    if (found_count == lines_wanted){
+        std::copy(found, found + found_count, lines);
+        line_count = found_count;
+    }
+    move_to_make = found[0].move;
+    root_to_front(move_to_make);
+
+    return found[0].score;
+}
+
+/*
+Generates the root moves for a new search, in move generator order.
+
+Once the root itself is in the endgame databases, every move would be cut off by a
+probe one ply down, and the search couldn't tell the wins apart by more than a guess.
+The search then only takes database values after the next capture, and at the leaves,
+and the root moves that would give up the value of the position are dropped here.
+*/
+void cpu::init_root_moves(Board &board){
     Move movelist[MAX_MOVES];
-    int move_count = board.gen_moves(movelist, (char)-1);
-    
-    val = search_root(board, 1, -MAX_VAL, MAX_VAL);
+    root_move_count = board.gen_moves(movelist, (char)-1);
+
+    const int pieces = board.piece_count[BLACK] + board.piece_count[WHITE];
+    egdb_search_pieces = options.egdb ? std::min(egdb.pieces(), pieces - 1) : 0;
+    for (cpu * helper : helpers) helper->egdb_search_pieces = egdb_search_pieces;
+    if (options.egdb && pieces <= egdb.pieces()) root_move_count = egdb_root_moves(board, movelist, root_move_count);
+
+    for (int i = 0; i < root_move_count; i++){
+        order_moves(root_move_count, movelist, i);
+        root_moves[i] = {movelist[i], -MAX_VAL, 0};
+    }
+}
+
+/*
+Orders the root moves at the start of an iteration. The best move stays in front,
+the moves that raised alpha follow by their score, and the rest by the size of their
+subtree: a move that took many nodes to refute came close to being the best.
+*/
+void cpu::sort_root_moves(){
+    std::stable_sort(root_moves + 1, root_moves + std::max(root_move_count, 1), [](const root_move &a, const root_move &b){
+        if (a.score != b.score) return a.score > b.score;
+        return a.nodes > b.nodes;
+    });
+
+    for (int i = 0; i < root_move_count; i++){
+        root_moves[i].score = -MAX_VAL;
+        root_moves[i].nodes = 0;
+    }
+}
+
+/*
+Moves a root move to the front of the list, keeping the order of the others.
+
+@return
+   false if it is not one of the root moves
+*/
+bool cpu::root_to_front(const Move &m){
+    for (int i = 0; i < root_move_count; i++){
+        if (root_moves[i].move.same_as(m)){
+            std::rotate(root_moves, root_moves + i, root_moves + i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Prints the best lines of the last iteration */
+void cpu::report_lines(){
+    for (int k = 0; k < line_count; k++){
+        std::cout << "depth " << lines[k].depth;
+        if (line_count > 1) std::cout << " line " << k + 1;
+        std::cout << " score " << (double)lines[k].score/75 << " nodes " << total_nodes();
+        std::cout << " time " << tm.elapsed() << " pv";
+        for (int i = 0; i < lines[k].pv_length; i++){
+            std::cout << " ";
+            lines[k].pv[i].print_move_info();
+        }
+        std::cout << "\n";
+    }
+}
+
+/* Saves the line that search_root just found */
+void cpu::store_line(Board &board, pv_line &line, int score, int depth){
+    line.move = move_to_make;
+    line.score = score;
+    line.depth = depth;
+    line.pv_length = 0;
+
+    /* A root search that never raised alpha leaves no line behind, so fall back to the move alone */
+    if (pv_length[0] && pv_table[0][0].same_as(move_to_make)){
+        line.pv_length = pv_length[0];
+        memcpy(line.pv, pv_table[0], pv_length[0] * sizeof(Move));
+    }
+    else{
+        line.pv[0] = move_to_make;
+        line.pv_length = 1;
+    }
+    extend_line(board, line);
+}
+
+/*
+Null window searches (MTD(f), or a root search that failed high) and cutoffs from
+the table leave the line short, so it is continued with the hash moves in the table.
+*/
+void cpu::extend_line(Board board, pv_line &line){
+    Move m;
+    packed_move tt_move;
+
+    for (int i = 0; i < line.pv_length; i++) board.push_move(line.pv[i]);
+
+    while (line.pv_length < std::min(line.depth, MAX_PLY) && !board.check_repetition()){
+        tt_move = {};
+        table.probe(board.hash_key, 0, -MAX_VAL, MAX_VAL, &tt_move);
+        if (!board.unpack_move(tt_move, m)) break;
+
+        line.pv[line.pv_length++] = m;
+        board.push_move(m);
+    }
+}
+
+/* Makes the next search try the moves of an earlier line first */
+void cpu::load_prev_pv(const pv_line &line){
+    prev_pv_length = line.pv_length;
+    memcpy(prev_pv, line.pv, line.pv_length * sizeof(Move));
+    follow_pv = true;
+}
+
+int cpu::search_iterate(Board &board){
+    int val = 0;
+    init_root_moves(board);
+    line_count = 0;
+    set_pool_searching(true);
+
+    tm.iteration_started();
+    val = search_lines(board, 1, val);
+    tm.iteration_finished(false, 0);
     current_depth = 2;
     /* Searches with increasing depth until the time is up */
     while (!search_cancelled){
-        if ((move_count == 1 && current_depth == 5) || abs(val) > 5000){
+        if ((root_move_count == 1 && current_depth == 5) || abs(val) > 5000){
             search_cancelled = true;
             break;
         }
-        val = search_widen(board, current_depth, val);
+
+        if (depth_limit && current_depth > depth_limit) break;
+
+        /* Don't start an iteration that the time manager expects not to finish */
+        if (!tm.can_start_iteration()){
+            search_cancelled = true;
+            break;
+        }
+
+        Move prev_best = move_to_make;
+        int prev_val = val;
+
+        tm.iteration_started();
+        val = search_lines(board, current_depth, val);
+        if (!search_cancelled){
+            tm.iteration_finished(!move_to_make.same_as(prev_best), prev_val - val);
+            if (feedback) report_lines();
+        }
         current_depth++;
     }
 
+    set_pool_searching(false);
     return val;
 }
 
@@ -579,6 +1291,8 @@ Perfoms a minimax search up to the max_depth of the cpu
 and returns the best move.
 */
 Move cpu::max_depth_search(Board &board, bool feedback){
+    if (book_move(board, feedback)) return move_to_make;
+
     if (feedback){
         std::cout << "calculating... \n";
     }
@@ -586,9 +1300,16 @@ Move cpu::max_depth_search(Board &board, bool feedback){
     Move movelist[MAX_MOVES];
     board.gen_moves(movelist, (char)-1);
     move_to_make = movelist[0];
-    time_limit = INFINITY;
+    set_limits(search_limits());
+    nodes_traversed = 0;
+    search_cancelled = false;
+    prepare_helpers();
+
+    init_root_moves(board);
 
+    set_pool_searching(true);
     int val = search_root(board, max_depth, -MAX_VAL, MAX_VAL);
+    set_pool_searching(false);
 
     if (feedback){
         std::cout << "The best move has a value of " << (double)val/75;
@@ -616,27 +1337,246 @@ void cpu::order_moves(int movecount, Move * m, int current){
 Finds the best move, but is limited by a time limit t(seconds)
 */
 Move cpu::time_search(Board board, double t_limit, bool feedback){
-    Move movelist[MAX_MOVES];
-    board.gen_moves(movelist, (char)-1);
-    move_to_make = movelist[0];
+    search_limits limits;
+    limits.movetime = std::max(t_limit*1000, 1.0);//converts seconds to milliseconds
+    return go(board, limits, feedback);
+}
+
+/*
+Finds the best move, budgeting the time from what is left on the game clock
+*/
+Move cpu::clock_search(Board board, const game_clock &clock, bool feedback){
+    search_limits limits;
+    limits.clock = clock;
+    return go(board, limits, feedback);
+}
+
+/*
+Finds the best move with iterative deepening under any combination of limits.
+Searches that are only limited by depth and nodes do not look at the clock, so
+after clear() they give the same result and node count on every run.
+*/
+Move cpu::go(Board board, const search_limits &limits, bool feedback){
+    set_limits(limits);
+    if (book_move(board, feedback)) return move_to_make;
+    return start_search(board, feedback);
+}
+
+/* Sets the time manager and the depth and node limits for the next search */
+void cpu::set_limits(const search_limits &limits){
+    depth_limit = limits.depth;
+    node_limit = limits.nodes ? limits.nodes : UINT64_MAX;
+
+    if (limits.infinite || (!limits.movetime && !limits.clock.remaining)) tm.init_infinite();
+    else if (limits.movetime)                                               tm.init_movetime(limits.movetime);
+    else                                                                    tm.init_clock(limits.clock);
+}
+
+/*
+Looks the position up in the opening book. A book move is played as it is, with
+the score and depth of the search that put it in the book as the only line.
+
+@return
+   true if move_to_make is a book move
+*/
+bool cpu::book_move(Board &board, bool feedback){
+    book_entry entry;
+    if (!options.book || !book.size() || !book.pick(board, move_to_make, entry)) return false;
+
     nodes_traversed = 0;
-    table.fails = 0;
+    lines[0].move = move_to_make;
+    lines[0].score = entry.score;
+    lines[0].depth = entry.depth;
+    lines[0].pv[0] = move_to_make;
+    lines[0].pv_length = 1;
+    line_count = 1;
 
     if (feedback){
-        std::cout << "calculating... \n";
+        std::cout << "Book move, value " << (double)entry.score/75 << " at depth " << entry.depth << "\n";
     }
+    return true;
+}
 
-    // Starts the time manager
-    search_cancelled = false;
-    time_limit = t_limit*1000;//converts seconds to milliseconds
-    search_start = get_time();
+/* Forgets everything learned in earlier searches */
+void cpu::clear(){
+    stop_ponder();
+    table.clear();
+    eval_table.clear();
+    clear_heuristics();
+    for (cpu * helper : helpers){
+        helper->eval_table.clear();
+        helper->clear_heuristics();
+    }
+}
+
+void cpu::clear_heuristics(){
+    memset(killers, 0, sizeof(killers));
+    memset(cutoff, 0, sizeof(cutoff));
+    memset(history, 0, sizeof(history));
+    memset(countermoves, 0, sizeof(countermoves));
+    memset(cont_history, 0, 2 * sizeof(cont_table));
+    memset(move_stack, 0, sizeof(move_stack));
+}
+
+/* Runs the iterative deepening search under the limits already set in the time manager */
+Move cpu::start_search(Board &board, bool feedback){
+    prepare_search(board);
+    this->feedback = feedback;
+
+    if (feedback){
+        std::cout << "calculating... \n";
+    }
 
     int val = search_iterate(board);
     
-    if (feedback){
-        std::cout << "The best move has a value of " << (double)val/75 << ", max depth reached was " << current_depth - 1;
-        std::cout << ", time elapsed: " << (int)(get_time() - search_start) << " milliseconds\n";
-        std::cout << "Nodes Traversed: " << nodes_traversed << "\n";
+    if (feedback) report_search(val);
+    return move_to_make;
+}
+
+/* Resets the per-search state. Must happen before a search thread is started. */
+void cpu::prepare_search(Board &board){
+    Move movelist[MAX_MOVES];
+    board.gen_moves(movelist, (char)-1);
+    move_to_make = movelist[0];
+    nodes_traversed = 0;
+    table.fails = 0;
+    search_cancelled = false;
+    root_excluded = 0;
+    feedback = false;
+    follow_pv = false;
+    prev_pv_length = 0;
+    pv_length[0] = 0;
+    root_passes = 0;
+    root_iterations = 0;
+    etc_cutoffs = 0;
+    quiesce_nodes = 0;
+    egdb_hits = 0;
+    prepare_helpers();
+}
+
+/* Gives the helper threads the settings of this search */
+void cpu::prepare_helpers(){
+    start_helpers();
+    split_count = 0;
+    for (cpu * helper : helpers){
+        helper->options = options;
+        helper->set_color(color);
+        helper->nodes_traversed = 0;
+        helper->split_count = 0;
+        helper->etc_cutoffs = 0;
+        helper->quiesce_nodes = 0;
+        helper->egdb_hits = 0;
+    }
+}
+
+void cpu::report_search(int val){
+    std::cout << "The best move has a value of " << (double)val/75 << ", max depth reached was " << current_depth - 1;
+    std::cout << ", time elapsed: " << (int)tm.elapsed() << " milliseconds\n";
+    std::cout << "Nodes Traversed: " << total_nodes() << "\n";
+    std::cout << "Root passes: " << root_passes << " in " << root_iterations << " iterations\n";
+
+    uint64_t skipped = etc_cutoffs;
+    for (const cpu * helper : helpers) skipped += helper->etc_cutoffs;
+    std::cout << "Transposition cutoffs before searching: " << skipped << "\n";
+
+    uint64_t nodes = total_nodes();
+    if (nodes) std::cout << "Quiescence nodes: " << (100 * total_quiesce_nodes()) / nodes << "%\n";
+    if (egdb.pieces()) std::cout << "Endgame database hits: " << total_egdb_hits() << "\n";
+    if (!helpers.empty()){
+        uint64_t splits = split_count;
+        for (const cpu * helper : helpers) splits += helper->split_count;
+        std::cout << "Threads: " << helpers.size() + 1 << ", split points: " << splits << "\n";
     }
+}
+
+/*
+Starts searching in the background on the opponent's time. The cpu guesses the
+opponent's reply from the transposition table and searches the position after it,
+filling the table for the real search.
+
+@param board
+   the position after the cpu's own move, with the opponent to play
+@return
+   false if there is nothing to ponder on
+*/
+bool cpu::start_ponder(const Board &board){
+    Move movelist[MAX_MOVES];
+    packed_move tt_move = {};
+
+    stop_ponder();
+
+    ponder_board = board;
+    int movecount = ponder_board.gen_moves(movelist, (char)-1);
+    if (!movecount || ponder_board.check_repetition()) return false;
+
+    /* The expected reply is the best move stored for this position, if the table has one */
+    table.probe(ponder_board.hash_key, 0, -MAX_VAL, MAX_VAL, &tt_move);
+    if (!ponder_board.unpack_move(tt_move, ponder_move)) ponder_move = movelist[0];
+
+    ponder_board.push_move(ponder_move);
+    Move replies[MAX_MOVES];
+    if (!ponder_board.gen_moves(replies, (char)-1) || ponder_board.check_repetition()) return false;
+
+    /* Book positions are answered without a search */
+    const book_entry * first;
+    if (options.book && book.probe(ponder_board.hash_key, &first)) return false;
+
+    set_limits(search_limits());
+    ponder_hit_pending = false;
+    prepare_search(ponder_board);
+
+    ponder_thread = std::thread([this]{
+        ponder_val = search_iterate(ponder_board);
+    });
+    return true;
+}
+
+/*
+The opponent played the expected move. The running search becomes the real one,
+limited by t_limit seconds from now, and its best move is returned.
+*/
+Move cpu::ponder_hit(double t_limit, bool feedback){
+    ponder_tm.init_movetime(t_limit*1000);
+    return finish_ponder(feedback);
+}
+
+/* Same as above, but with the time budgeted from the game clock */
+Move cpu::ponder_hit(const game_clock &clock, bool feedback){
+    ponder_tm.init_clock(clock);
+    return finish_ponder(feedback);
+}
+
+Move cpu::finish_ponder(bool feedback){
+    ponder_hit_pending = true;
+    ponder_thread.join();
+
+    /* The search may have ended on its own before it noticed the hit */
+    if (ponder_hit_pending) convert_ponder();
+
+    if (feedback) report_search(ponder_val);
     return move_to_make;
-}
\ No newline at end of file
+}
+
+/*
+Hands the new limits to the search. This runs on the search thread, so the
+time manager is never written while the search reads it.
+*/
+void cpu::convert_ponder(){
+    tm = ponder_tm;
+    ponder_hit_pending = false;
+}
+
+/* The opponent played something else, so the ponder search is thrown away */
+void cpu::stop_ponder(){
+    if (!ponder_thread.joinable()) return;
+
+    search_cancelled = true;
+    ponder_thread.join();
+    ponder_hit_pending = false;
+}
+
+cpu::~cpu(){
+    stop_ponder();
+    stop_helpers();
+    delete[] cont_history;
+}
@@ -3,16 +3,197 @@
 #include "misc.hpp"
 #include "board.hpp"
 #include "transposition.hpp"
+#include "timeman.hpp"
+#include "egdb.hpp"
+#include "book.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <time.h>
+#include <vector>
 
 #define DO_NULL    1
 #define NO_NULL    0
 #define IS_PV      1
 #define NO_PV      0
 
+#define MAX_PLY    128
+
+#define RUNAWAY_MAX_DISTANCE 7 // moves the furthest man back needs to promote
+
+/*
+Value of a position the endgame databases say is won, give or take EGDB_PROGRESS for how
+close the winning side is to the end. Far from mate scores, and above any eval. It doesn't
+depend on the ply, so the transposition table keeps it as it is.
+*/
+#define EGDB_WIN_VAL      3000
+#define EGDB_PROGRESS     1000
+#define EGDB_CHASE        5     // per square between a winning king and the nearest losing piece
+#define NNUE_EVAL_MAX     (EGDB_WIN_VAL - EGDB_PROGRESS - 1) // network evals are clamped to +-NNUE_EVAL_MAX
+#define HISTORY_MAX       16384 // history scores stay within +-HISTORY_MAX
+#define HISTORY_BONUS_MAX 1600
+
+/* History of a quiet move [from][to] after an earlier move [from][to] */
+typedef int16_t cont_table[32][32][32][32];
+
+/*
+Switches and parameters for the pruning and reduction features of the search.
+Every cpu carries its own copy, so different variants can be benchmarked and
+played against each other inside one binary.
+*/
+struct search_options{
+    /* Static eval pruning at shallow, quiet, non-PV nodes */
+    bool static_prune = true;
+    int static_prune_depth = 3;   // prune while depth is below this
+    int static_prune_margin = 40; // margin per remaining ply
+
+    /*
+    ProbCut at deep, non-PV nodes. The margin, slope and intercept should come from
+    the comp tool's calibration mode, for the depth and reduction used.
+    */
+    bool probcut = false;
+    int probcut_depth = 6;        // only at nodes at least this deep
+    int probcut_reduction = 4;    // the verification search is this much shallower
+    int probcut_margin = 18;      // how far above beta the predicted deep value has to be
+    int probcut_slope = 100;      // deep = slope / 100 * shallow + intercept
+    int probcut_intercept = 0;
+
+    /* Late move reductions */
+    bool lmr = true;
+    int lmr_min_depth = 3;        // only reduce when the new depth is above this
+    int lmr_min_moves = 1;        // only reduce after this many moves were tried
+    int lmr_late_moves = 6;       // reduce one more ply after this many moves
+    int lmr_cutoff_threshold = 50; // moves whose cutoff score is at or above this are never reduced
+    int lmr_cutoff_bonus = 6;     // added to a move's cutoff score when it raises alpha
+
+    /* Aspiration windows */
+    bool aspiration = true;
+    int aspiration_depth = 8;     // below this depth the fixed window is used
+    int aspiration_window = 50;   // fixed window
+    int aspiration_base = 20;     // window = base + |score| / divisor
+    int aspiration_divisor = 8;
+    int aspiration_searches = 3;  // re-searches before falling back to a full window
+
+    /* MTD(f) null window passes at the root instead of aspiration windows */
+    bool mtdf = false;
+    int mtdf_step = 1;            // first distance of the test value from the guess, doubled on every miss
+
+    /* Enhanced transposition cutoffs: look the children up in the table before searching any of them */
+    bool etc = true;
+    int etc_depth = 4;            // only at non-PV nodes at least this deep
+
+    /* Move ordering by the moves played before */
+    bool cont_history = true;     // continuation history one and two plies back
+    bool countermoves = false;    // order the last refutation of the previous move after the killers
+    bool history_malus = false;   // lower the history of quiet moves searched before a cutoff
+
+    /* Keep searching forced moves in quiescence instead of evaluating */
+    bool quiesce_forced_ext = true;
+
+    /* Search the reply to a single legal move at the same depth, and cache the end of the chain */
+    bool forced_chains = false;
+
+    /* Quiescence */
+    bool quiesce_tt = false;      // probe and store the transposition table at depth 0
+    int quiesce_max_ply = 32;     // plies of quiescence before the position is evaluated as it is
+    bool quiesce_stand_pat = false; // let the side to move stand pat even when it has to capture
+
+    /* Evaluate with the network instead of the handcrafted eval, when one is loaded */
+    bool nnue = true;
+
+    /* Stop evaluating once the terms left can't bring the score inside the window */
+    bool lazy_eval = true;
+
+    /* Take the values of positions in the endgame databases, when they are loaded */
+    bool egdb = true;
+
+    /* Play moves from the opening book without searching, when one is loaded */
+    bool book = true;
+
+    /* Number of best root moves to find with exact scores */
+    int multi_pv = 1;
+
+    /* Young brothers wait parallel search */
+    int threads = 1;              // searching threads, including the one that called the search
+    int split_depth = 4;          // only share out the moves of nodes at least this deep
+
+    bool set(const std::string &name, int value);
+    void print() const;
+};
+
+/* A move at the root, with what the search learned about it in the current iteration */
+struct root_move{
+    Move move;
+    int score;          // value when it last raised alpha, -MAX_VAL if it hasn't
+    uint64_t nodes;     // nodes searched below it
+};
+
+/* One of the best root moves found in analysis, with the line of play expected after it */
+struct pv_line{
+    Move move;
+    int score;
+    int depth;
+    int pv_length;
+    Move pv[MAX_PLY];
+};
+
+/*
+Limits for a single search. Any combination can be given, and the search stops
+at whichever is reached first. Without a depth, node or time limit the search
+runs until it is cancelled or finds a decisive result.
+*/
+struct search_limits{
+    int depth = 0;         // Deepest iteration to search, 0 for no limit
+    uint64_t nodes = 0;    // Exact number of nodes to search, 0 for no limit
+    uint64_t movetime = 0; // Milliseconds to search for, 0 for no limit
+    bool infinite = false; // Ignore movetime and the clock
+    game_clock clock;      // Budget the time from the clock when there is no movetime
+};
+
+/*
+A node whose remaining moves are shared out between threads. The thread that owns
+the node searches the first move alone (the eldest brother), then the younger
+brothers are taken one at a time by the owner and by any idle thread that steals
+the split point, until none are left or one of them fails high.
+*/
+struct split_point{
+    split_point * parent;         // split point the owner was working under
+    Board board;
+    int depth;
+    int ply;
+    int beta;
+    int is_pv;
+    Move movelist[MAX_MOVES];
+    int movecount;
+    Move prev_moves[2];           // the two moves played before the node, for the continuation history
+
+    /* Everything below changes during the search and is guarded by lock */
+    std::mutex lock;
+    int next;
+    int moves_tried;
+    int alpha;
+    int raised_alpha;
+    packed_move bestmove;
+    Move pv[MAX_PLY];
+    int pv_length;
+    std::atomic<bool> cutoff{false};
+    std::atomic<int> helpers{0};  // threads other than the owner still searching here
+
+    /* A cutoff here or at any split point above makes the work pointless */
+    inline bool cut_off() const{
+        for (const split_point * sp = this; sp; sp = sp->parent)
+            if (sp->cutoff) return true;
+        return false;
+    }
+};
+
 //VERSION 1.0
 class cpu{
     int max_depth;
@@ -23,24 +204,81 @@ class cpu{
         int current_depth;
         int color;
         unsigned long nodes_traversed;
-        uint64_t time_limit;
+
+        /* Best root moves of the last completed iteration, best first */
+        pv_line lines[MAX_MOVES];
+        int line_count = 0;
+
+        /* Calls of search_root, and root searches they were spent on, in the last search */
+        uint64_t root_passes = 0;
+        uint64_t root_iterations = 0;
+
+        /* Nodes cut by a child found in the table, in the last search */
+        uint64_t etc_cutoffs = 0;
+
+        /* Nodes searched in quiescence, in the last search */
+        uint64_t quiesce_nodes = 0;
+
+        /* Positions found in the endgame databases, in the last search */
+        uint64_t egdb_hits = 0;
+
+        time_manager tm;
         tt_table table;
         tt_eval_table eval_table;
 
-        cpu(int cpu_color = 0, int cpu_depth = 10);
+        search_options options;
+
+        cpu(int cpu_color = 0, int cpu_depth = 10, search_options opts = search_options());
+        uint64_t total_nodes() const;
+        uint64_t total_quiesce_nodes() const;
+        uint64_t total_egdb_hits() const;
         Move max_depth_search(Board &board, bool feedback = true);
         Move time_search(Board board, double t_limit, bool feedback = true);
+        Move clock_search(Board board, const game_clock &clock, bool feedback = true);
+        Move go(Board board, const search_limits &limits, bool feedback = true);
+        void clear();
         int search_root(Board &board, int depth, int alpha, int beta);
         int search(Board &board, int depth, int ply, int alpha, int beta, int is_pv);
+
+        /* Pondering: searching the expected reply while the opponent is thinking */
+        Move ponder_move;
+        bool start_ponder(const Board &board);
+        Move ponder_hit(double t_limit, bool feedback = true);
+        Move ponder_hit(const game_clock &clock, bool feedback = true);
+        void stop_ponder();
+        inline bool is_pondering() const { return ponder_thread.joinable(); }
         
         void set_color(int new_color);
         void set_depth(int new_depth);
+        void set_options(const search_options &opts);
+
+        /* Terms of the handcrafted eval from black's point of view. Static so that tune can compute them for any weights. */
+        static int mobility_count(Bitboards board);
+        static int past_pawns(Bitboards board, int runaway_value);
+
+        ~cpu();
 
     private:
         Move killers[1024][2];
         int cutoff[2][32][32];
         int history[2][32][32];
-        uint8_t bestmove;
+
+        /*
+        Move ordering keyed by the moves played before. A countermove is the last quiet
+        move to refute a move, and the continuation histories score quiet moves by how
+        well they did after the move one ply back [0] and two plies back [1]. Moves are
+        keyed by their start and end squares. The continuation histories are 4MB, so
+        they live on the heap.
+        */
+        packed_move countermoves[32][32];
+        cont_table * cont_history = nullptr;
+
+        /* The move played at each ply on the way to the node being searched. The root move is move_stack[0]. */
+        Move move_stack[1024 + 1];
+
+        /* The root moves, kept from one iteration to the next */
+        root_move root_moves[MAX_MOVES];
+        int root_move_count = 0;
 
         const uint32_t square_map[34] = {
             (1 << 0), (1 << 1), (1 << 2), (1 << 3), (1 << 4), (1 << 5), (1 << 6), (1 << 7), (1 << 8), (1 << 9), (1 << 10), (1 << 11), (1 << 12), (1 << 13), (1 << 14), (1 << 15),
@@ -48,21 +286,119 @@ class cpu{
             0, 0 //     invalid no bits set
         };
         const uint32_t DOUBLE_CORNER = square_map[3] | square_map[7] | square_map[24] | square_map[28];
-        const uint32_t SINGLE_EDGE = square_map[0] | square_map[1] | square_map[2] | square_map[8] | square_map[15] | square_map[16] | square_map[23] |
-                                        square_map[29] | square_map[30] | square_map[31];
-        const uint32_t CENTER_8 = square_map[9] | square_map[10] | square_map[13] | square_map[14] | square_map[17] | square_map[18] | 
-                                        square_map[21] | square_map[22];
-        uint64_t search_start = time(NULL);
-        bool search_cancelled = false;
+        std::atomic<bool> search_cancelled{false};
+        std::atomic<bool> * stop_flag = &search_cancelled; // cancel flag of the cpu that started the search
         Move move_to_make;
+        int depth_limit = 0;
+        uint64_t node_limit = UINT64_MAX;
+        uint32_t root_excluded = 0; // Root moves (by id) that search_root skips
+        int egdb_search_pieces = 0; // Positions with more pieces are searched, and only looked up in the databases by quiesce
+        bool feedback = false;
+
+        /*
+        Triangular principal variation table. The line found at the root is in pv_table[0],
+        and a node at ply p stores its line in pv_table[p + 1].
+        */
+        Move pv_table[MAX_PLY][MAX_PLY];
+        int pv_length[MAX_PLY];
+        Move prev_pv[MAX_PLY];
+        int prev_pv_length = 0;
+        bool follow_pv = false;
 
+        std::thread ponder_thread;
+        Board ponder_board;
+        int ponder_val;
+        time_manager ponder_tm;                  // limits that take over on a ponder hit
+        std::atomic<bool> ponder_hit_pending{false};
+
+        /*
+        Helper threads for the parallel search. Each helper is a cpu of its own with its
+        own killers and history, sharing the transposition table of the cpu that owns it.
+        */
+        cpu * master = nullptr;                  // set on helpers only
+        std::vector<cpu*> helpers;
+        std::thread worker;
+        std::atomic<int> idle_helpers{0};
+        std::atomic<bool> pool_searching{false};
+        bool pool_quit = false;
+        std::mutex pool_lock;
+        std::condition_variable pool_wake;
+        std::deque<split_point*> split_queue;    // this thread's split points that still have moves
+        std::mutex split_queue_lock;
+        split_point * active_split = nullptr;    // split point this thread is searching under
+        uint64_t split_count = 0;
+
+        explicit cpu(cpu * master_cpu);
+        void start_helpers();
+        void prepare_helpers();
+        void stop_helpers();
+        void set_pool_searching(bool searching);
+        void idle_loop();
+        split_point * steal_split();
+        int split(Board &board, Move * moves, int count, const Move * searched, int depth, int ply,
+                  int alpha, int beta, int is_pv, int moves_tried, int raised_alpha, packed_move &bestmove);
+        void work_split(split_point &sp);
+        void clear_heuristics();
+
+        inline bool can_split(int depth) const{
+            const cpu * pool = master ? master : this;
+            return depth >= options.split_depth && pool->idle_helpers > 0;
+        }
+
+        /* True when this thread's work is no longer needed */
+        inline bool stopped() const{
+            return search_cancelled || *stop_flag || (active_split && active_split->cut_off());
+        }
+
+        void set_limits(const search_limits &limits);
+        bool book_move(Board &board, bool feedback);
+        Move start_search(Board &board, bool feedback);
+        void prepare_search(Board &board);
+        void report_search(int val);
+        Move finish_ponder(bool feedback);
+        void convert_ponder();
         int search_iterate(Board &board);
+        int search_driver(Board &board, int depth, int guess);
         int search_widen(Board &board, int depth, int val);
-        int quiesce(Board &board, int ply, int alpha, int beta);
+        int search_mtdf(Board &board, int depth, int guess);
+        int search_lines(Board &board, int depth, int val);
+        void init_root_moves(Board &board);
+        void sort_root_moves();
+        bool root_to_front(const Move &m);
+        void report_lines();
+        void store_line(Board &board, pv_line &line, int score, int depth);
+        void extend_line(Board board, pv_line &line);
+        void load_prev_pv(const pv_line &line);
+
+        /* Puts the move in front of the line of the child node, making it the line of this node */
+        inline void update_pv(int index, const Move &m){
+            if (index >= MAX_PLY - 1) return;
+            int length = std::min(pv_length[index + 1], MAX_PLY - 1);
+            pv_table[index][0] = m;
+            memcpy(&pv_table[index][1], pv_table[index + 1], length * sizeof(Move));
+            pv_length[index] = length + 1;
+        }
+        int search_move(Board &board, const Move &m, int depth, int ply, int alpha, int beta, int is_pv,
+                        int moves_tried, int raised_alpha);
+        void record_cutoff(const Move &m, int depth, int ply, const Move * quiets, int quiet_count);
+        void update_quiet_history(const Move &m, int ply, int bonus);
+
+        /* Gravity update: the closer a score is to the bound, the less a bonus moves it */
+        template <typename T>
+        static inline void update_history(T &entry, int bonus){
+            entry += bonus - entry * abs(bonus) / HISTORY_MAX;
+        }
+        int probe_children(Board &board, Move * movelist, int movecount, int depth, int beta);
+        int quiesce(Board &board, int ply, int qply, int alpha, int beta);
+        int probe_egdb(Board &board);
+        int egdb_root_moves(Board &board, Move * movelist, int count);
+
+        /* True when the position may be in the endgame databases */
+        inline bool in_egdb_range(const Board &board) const{
+            return options.egdb && board.piece_count[BLACK] + board.piece_count[WHITE] <= egdb.pieces();
+        }
 
-        int mobility_score(Bitboards board);
-        int past_pawns(Bitboards board);
-        int eval(Board &board);
+        int eval(Board &board, int alpha = -MAX_VAL, int beta = MAX_VAL);
         int draw_eval(Board &board);
         void set_killers(Move m, int ply);
         void age_history_table();
@@ -70,9 +406,12 @@ class cpu{
         void set_move_scores(Move * m, int movecount, int ply);
         void order_moves(int movecount, Move * m, int current);
 
+        /* The node limit is checked at every node so that node limited searches are exactly repeatable */
         inline void check_time(){
+            if (nodes_traversed >= node_limit) search_cancelled = true;
             if (!(nodes_traversed & 4095) && !search_cancelled){
-                search_cancelled = get_time() - search_start > time_limit;
+                if (ponder_hit_pending) convert_ponder();
+                search_cancelled = tm.out_of_time();
             }
         }
 };
\ No newline at end of file
@@ -0,0 +1,323 @@
+#include "cpu.hpp"
+#include "board.hpp"
+#include "transposition.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+const int MAX_GAME_LENGTH = 300;
+
+int ponder_hits = 0;
+int ponder_misses = 0;
+
+/*
+Reads a line of "name=value" pairs into a set of options. The word
+"default" (or an empty line) leaves the options untouched.
+
+@return
+   false if any of the names is not a known option, or a value is not a whole number
+*/
+bool parse_options(const std::string &line, search_options &opts){
+    std::istringstream stream(line);
+    std::string token;
+
+    while (stream >> token){
+        if (token == "default") continue;
+
+        size_t split = token.find('=');
+        if (split == std::string::npos){
+            std::cout << "Unknown option: " << token << "\n";
+            return false;
+        }
+
+        const std::string text = token.substr(split + 1);
+        char * end;
+        errno = 0;
+        long value = strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end || errno == ERANGE || value < INT_MIN || value > INT_MAX){
+            std::cout << "Bad value: " << token << "\n";
+            return false;
+        }
+
+        if (!opts.set(token.substr(0, split), (int)value)){
+            std::cout << "Unknown option: " << token << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Sets up an opening by playing random moves from the starting position.
+The same seed always gives the same opening.
+*/
+Board random_opening(int seed, int plies){
+    Move movelist[MAX_MOVES];
+    Board board;
+
+    do {
+        srand(seed++);
+        board.reset();
+        board.set_random_pos(plies);
+    } while (!board.gen_moves(movelist, (char)-1));
+
+    return board;
+}
+
+/*
+Plays a game between two cpus from the given position. With pondering on,
+each cpu keeps searching in the background while the other one thinks.
+
+@return
+   1 if black wins, 2 if white wins, 0 for a draw
+*/
+int play_game(cpu &black, cpu &white, Board board, const search_limits &limits, bool ponder){
+    cpu * players[2] = {&black, &white};
+    Move movelist[MAX_MOVES];
+    Move last_move = {};
+    int result = 0;
+    black.set_color(BLACK);
+    white.set_color(WHITE);
+
+    for (int i = 0; i < MAX_GAME_LENGTH; i++){
+        board.gen_moves(movelist, (char)-1);
+        if (board.check_win()){
+            result = board.check_win();
+            break;
+        }
+        if (board.check_repetition()) break;
+
+        cpu &mover = *players[board.bb.stm];
+        Move m;
+        if (mover.is_pondering() && last_move.same_as(mover.ponder_move)){
+            ponder_hits++;
+            m = mover.ponder_hit(limits.movetime / 1000.0, false);
+        }
+        else{
+            if (mover.is_pondering()) ponder_misses++;
+            mover.stop_ponder();
+            m = mover.go(board, limits, false);
+        }
+        board.push_move(m);
+        last_move = m;
+
+        if (ponder) mover.start_ponder(board);
+    }
+
+    black.stop_ponder();
+    white.stop_ponder();
+    return result;
+}
+
+/*
+Plays pairs of games from random openings, with each variant taking both colors.
+Node limited games don't depend on the load of the machine.
+*/
+void run_match(cpu &a, cpu &b){
+    int games, plies;
+    bool ponder = false;
+    double t;
+    search_limits limits;
+
+    std::cout << "game pairs: ";
+    std::cin >> games;
+    std::cout << "time per move (seconds, or 0 to limit nodes instead): ";
+    std::cin >> t;
+    if (t > 0){
+        limits.movetime = t * 1000;
+    }
+    else{
+        std::cout << "nodes per move: ";
+        std::cin >> limits.nodes;
+    }
+    std::cout << "random opening plies: ";
+    std::cin >> plies;
+    if (limits.movetime){
+        std::cout << "ponder (0/1): ";
+        std::cin >> ponder;
+    }
+    std::cout << "\n";
+
+    int wins = 0, losses = 0, draws = 0;
+    for (int g = 0; g < games; g++){
+        Board opening = random_opening(g * 1000 + 1, plies);
+
+        for (int side = 0; side < 2; side++){
+            int result = side ? play_game(b, a, opening, limits, ponder) : play_game(a, b, opening, limits, ponder);
+
+            if      (!result)                 draws++;
+            else if ((result == 1) == !side)  wins++;
+            else                              losses++;
+        }
+        std::cout << "after " << (g + 1) * 2 << " games, A: +" << wins << " -" << losses << " =" << draws << "\n";
+    }
+
+    double score = (wins + draws * 0.5) / (games * 2);
+    std::cout << "\nA scored " << score * 100 << "%";
+    if (score > 0 && score < 1)
+        std::cout << " (" << -400 * log10(1 / score - 1) << " elo)";
+    std::cout << "\n";
+    if (ponder)
+        std::cout << "ponder hits: " << ponder_hits << ", misses: " << ponder_misses << "\n";
+}
+
+/*
+Searches the same positions to a fixed depth with both variants and compares the
+work done. Tables are cleared before every search so the node counts are repeatable.
+*/
+void run_bench(cpu &a, cpu &b){
+    int depth, positions, plies;
+
+    std::cout << "depth: ";
+    std::cin >> depth;
+    std::cout << "positions: ";
+    std::cin >> positions;
+    std::cout << "random opening plies: ";
+    std::cin >> plies;
+    std::cout << "\n";
+
+    cpu * variants[2] = {&a, &b};
+    uint64_t nodes[2] = {0, 0};
+    uint64_t quiesce_nodes[2] = {0, 0};
+    uint64_t egdb_hits[2] = {0, 0};
+    uint64_t elapsed[2] = {0, 0};
+    uint64_t passes[2] = {0, 0};
+    uint64_t iterations[2] = {0, 0};
+    search_limits limits;
+    limits.depth = depth;
+
+    for (int p = 0; p < positions; p++){
+        Board board = random_opening(p * 1000 + 1, plies);
+
+        for (int v = 0; v < 2; v++){
+            variants[v]->set_color(board.bb.stm);
+            variants[v]->clear();
+
+            uint64_t start = get_time();
+            variants[v]->go(board, limits, false);
+            elapsed[v] += get_time() - start;
+            nodes[v] += variants[v]->total_nodes();
+            quiesce_nodes[v] += variants[v]->total_quiesce_nodes();
+            egdb_hits[v] += variants[v]->total_egdb_hits();
+            passes[v] += variants[v]->root_passes;
+            iterations[v] += variants[v]->root_iterations;
+        }
+    }
+
+    for (int v = 0; v < 2; v++){
+        std::cout << (v ? "B" : "A") << ": " << nodes[v] << " nodes, " << elapsed[v] << " ms";
+        if (elapsed[v] > 0)
+            std::cout << ", " << nodes[v] / elapsed[v] << " KNodes/s";
+        if (iterations[v])
+            std::cout << ", " << (double)passes[v] / iterations[v] << " root passes per iteration";
+        if (nodes[v])
+            std::cout << ", " << (100 * quiesce_nodes[v]) / nodes[v] << "% in quiescence";
+        if (egdb.pieces())
+            std::cout << ", " << egdb_hits[v] << " database hits";
+        std::cout << "\n";
+    }
+    if (nodes[0])
+        std::cout << "B/A node ratio: " << (double)nodes[1] / nodes[0] << "\n";
+}
+
+/*
+Logs the root scores of a shallow and a deep search of the same positions, and fits
+deep = a * shallow + b with least squares. The fit gives the ProbCut slope and
+intercept, and the spread of the deep scores around it (sigma) sets the margin: a
+predicted deep score margin past beta fails to be a deep cut with a chance that
+shrinks as the margin grows in sigmas.
+*/
+void run_calibration(cpu &a){
+    int shallow_depth, deep_depth, positions;
+    double sigmas;
+
+    std::cout << "shallow depth: ";
+    std::cin >> shallow_depth;
+    std::cout << "deep depth: ";
+    std::cin >> deep_depth;
+    std::cout << "positions: ";
+    std::cin >> positions;
+    std::cout << "margin in sigmas: ";
+    std::cin >> sigmas;
+    std::cout << "\n";
+
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    search_limits limits;
+
+    for (int p = 0; p < positions; p++){
+        Board board = random_opening(p * 1000 + 1, 4 + p % 20);
+        int score[2];
+
+        for (int d = 0; d < 2; d++){
+            limits.depth = d ? deep_depth : shallow_depth;
+            a.set_color(board.bb.stm);
+            a.clear();
+            a.go(board, limits, false);
+            score[d] = a.lines[0].score;
+        }
+
+        /* Won and lost positions say nothing about the error of the search */
+        if (abs(score[0]) > 1000 || abs(score[1]) > 1000) continue;
+
+        n++;
+        sx += score[0];
+        sy += score[1];
+        sxx += (double)score[0] * score[0];
+        sxy += (double)score[0] * score[1];
+        syy += (double)score[1] * score[1];
+    }
+
+    if (n < 3 || n * sxx == sx * sx){
+        std::cout << "not enough positions\n";
+        return;
+    }
+
+    double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    double intercept = (sy - slope * sx) / n;
+    double residual = syy - 2 * slope * sxy - 2 * intercept * sy + slope * slope * sxx
+                    + 2 * slope * intercept * sx + n * intercept * intercept;
+    double sigma = sqrt(std::max(residual, 0.0) / (n - 2));
+
+    std::cout << n << " positions, deep = " << slope << " * shallow + " << intercept << ", sigma " << sigma << "\n";
+    std::cout << "probcut_reduction=" << deep_depth - shallow_depth << " probcut_margin=" << (int)(sigmas * sigma + 0.5)
+              << " probcut_slope=" << (int)(100 * slope + 0.5) << " probcut_intercept=" << (int)lround(intercept) << "\n";
+}
+
+int main(){
+    set_hash_function();
+    weights.load(WEIGHTS_FILE);
+    init_psq();
+    nnue_load(NNUE_FILE);
+    egdb.open(EGDB_DIR);
+    search_options opts[2];
+    std::string line;
+    int mode;
+
+    for (int v = 0; v < 2; v++){
+        do {
+            opts[v] = search_options();
+            std::cout << "Variant " << (v ? "B" : "A") << " options (name=value ..., or default): ";
+            std::getline(std::cin, line);
+        } while (!parse_options(line, opts[v]) && std::cin);
+    }
+
+    cpu a(BLACK, 10, opts[0]);
+    cpu b(WHITE, 10, opts[1]);
+
+    std::cout << "\nA: \n";
+    a.options.print();
+    std::cout << "B: \n";
+    b.options.print();
+
+    std::cout << "\nMatch(0), Depth Benchmark(1) or ProbCut Calibration of A(2)?: ";
+    std::cin >> mode;
+
+    if      (mode == 2) run_calibration(a);
+    else if (mode == 1) run_bench(a, b);
+    else                run_match(a, b);
+}
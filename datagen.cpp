@@ -0,0 +1,185 @@
+#include "cpu.hpp"
+#include "board.hpp"
+#include "training.hpp"
+#include "transposition.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Generates training positions by self-play. Each thread has its own cpu and plays
+whole games with a fixed number of nodes per move, starting from random openings.
+The quiet positions of a game are labelled with the score of the search made
+from them and the result of the game, and handed to a chunk_writer once the
+game is over.
+
+Node limited searches are repeatable and the tables are cleared before every
+game, so a game depends only on its number and the seed, not on the thread
+that played it.
+*/
+
+const int MAX_GAME_LENGTH = 300;
+
+/* Bytes for each table of a datagen cpu. Short searches don't need the full size, and there are many cpus. */
+const int DATAGEN_TABLE_SIZE = 0x400000;
+
+std::mutex opening_lock;
+
+struct datagen_settings{
+    int games;
+    int plies;
+    int seed;
+    search_limits limits;
+};
+
+struct datagen_stats{
+    std::atomic<int> next_game{0};
+    std::atomic<int> games_done{0};
+    std::atomic<uint64_t> positions{0};
+    std::atomic<uint64_t> results[3] = {{0}, {0}, {0}};
+    std::atomic<bool> failed{false};
+};
+
+/* rand is shared by all threads, so openings are made one at a time */
+Board random_opening(int seed, int plies){
+    std::lock_guard<std::mutex> guard(opening_lock);
+    Move movelist[MAX_MOVES];
+    Board board;
+
+    do {
+        srand(seed++);
+        board.reset();
+        board.set_random_pos(plies);
+    } while (!board.gen_moves(movelist, (char)-1));
+
+    return board;
+}
+
+/*
+Plays one game, adding its quiet positions to the batch.
+
+@return
+   the result in the form packed_position stores it
+*/
+uint8_t play_game(cpu &player, Board board, const search_limits &limits, std::vector<packed_position> &batch){
+    Move movelist[MAX_MOVES];
+    size_t first = batch.size();
+    uint8_t result = 1;
+
+    for (int i = 0; i < MAX_GAME_LENGTH; i++){
+        if (!board.gen_moves(movelist, (char)-1)){
+            result = board.bb.stm ? 2 : 0;
+            break;
+        }
+        if (board.check_repetition()) break;
+
+        player.set_color(board.bb.stm);
+        Move m = player.go(board, limits, false);
+
+        /* The eval is never used in positions with a capture, so they aren't worth keeping */
+        if (!board.jumpers()){
+            packed_position p;
+            p.pieces[BLACK] = board.bb.pieces[BLACK];
+            p.pieces[WHITE] = board.bb.pieces[WHITE];
+            p.kings = board.bb.kings;
+            p.score = std::max(-MAX_VAL, std::min(player.lines[0].score, MAX_VAL));
+            p.stm = board.bb.stm;
+            batch.push_back(p);
+        }
+        board.push_move(m);
+    }
+
+    for (size_t i = first; i < batch.size(); i++) batch[i].result = result;
+    return result;
+}
+
+void datagen_thread(cpu &player, const datagen_settings &settings, chunk_writer &writer, datagen_stats &stats){
+    std::vector<packed_position> batch;
+    int game;
+
+    while ((game = stats.next_game++) < settings.games && !stats.failed){
+        Board opening = random_opening(settings.seed + game * 1000, settings.plies);
+
+        batch.clear();
+        player.clear();
+        uint8_t result = play_game(player, opening, settings.limits, batch);
+
+        if (!writer.write(batch)) stats.failed = true;
+        stats.positions += batch.size();
+        stats.results[result]++;
+        stats.games_done++;
+    }
+}
+
+int main(){
+    set_hash_function();
+    weights.load(WEIGHTS_FILE);
+    init_psq();
+    nnue_load(NNUE_FILE);
+    egdb.open(EGDB_DIR);
+
+    datagen_settings settings;
+    std::string prefix;
+    uint64_t chunk_size;
+    int threads;
+
+    std::cout << "threads (0 for all cores): ";
+    std::cin >> threads;
+    std::cout << "games: ";
+    std::cin >> settings.games;
+    std::cout << "nodes per move: ";
+    std::cin >> settings.limits.nodes;
+    std::cout << "random opening plies: ";
+    std::cin >> settings.plies;
+    std::cout << "seed: ";
+    std::cin >> settings.seed;
+    std::cout << "output prefix: ";
+    std::cin >> prefix;
+    std::cout << "positions per file: ";
+    std::cin >> chunk_size;
+    std::cout << "\n";
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::unique_ptr<cpu>> players;
+    for (int t = 0; t < threads; t++){
+        players.emplace_back(new cpu(BLACK, 10, search_options()));
+        players.back()->table.set_size(DATAGEN_TABLE_SIZE);
+        players.back()->eval_table.set_size(DATAGEN_TABLE_SIZE);
+    }
+
+    chunk_writer writer(prefix, chunk_size);
+    datagen_stats stats;
+    std::vector<std::thread> workers;
+    uint64_t start = get_time();
+
+    for (int t = 0; t < threads; t++){
+        workers.emplace_back(datagen_thread, std::ref(*players[t]), std::cref(settings), std::ref(writer), std::ref(stats));
+    }
+
+    /* Progress every few seconds, until the workers are done */
+    int reported = 0;
+    while (stats.games_done < settings.games && !stats.failed){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        uint64_t elapsed = get_time() - start;
+        if (elapsed / 5000 > (uint64_t)reported){
+            reported = elapsed / 5000;
+            std::cout << stats.games_done << " games, " << stats.positions << " positions, "
+                      << stats.positions * 1000 / elapsed / threads << " positions/s per thread\n";
+        }
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    uint64_t elapsed = std::max<uint64_t>(get_time() - start, 1);
+    if (stats.failed) std::cout << "stopped: could not write the output\n";
+    std::cout << "\n" << stats.games_done << " games (black +" << stats.results[2] << " white +" << stats.results[0]
+              << " =" << stats.results[1] << "), " << writer.total() << " positions in " << writer.chunks() << " files\n";
+    std::cout << elapsed << " ms, " << writer.total() * 1000 / elapsed << " positions/s, "
+              << writer.total() * 1000 / elapsed / threads << " positions/s per thread\n";
+    return stats.failed;
+}
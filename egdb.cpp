@@ -0,0 +1,463 @@
+#include "egdb.hpp"
+
+#include "misc.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+const uint32_t FIRST_RANK = RANK[0];
+const uint32_t BLACK_MAN_SQUARES = ~RANK[7] & ~RANK[0]; // squares 4-27
+const uint32_t WHITE_MAN_SQUARES = ~RANK[0];             // squares 4-31
+
+/* Binomial coefficients, choose[n][k] */
+struct binomial_table{
+    uint64_t choose[33][33];
+
+    binomial_table(){
+        for (int n = 0; n <= 32; n++){
+            choose[n][0] = 1;
+            for (int k = 1; k <= 32; k++) choose[n][k] = n ? choose[n - 1][k - 1] + choose[n - 1][k] : 0;
+        }
+    }
+};
+
+static const binomial_table binomial;
+
+static inline uint64_t choose(int n, int k){
+    return (n < 0 || k < 0) ? 0 : binomial.choose[n][k];
+}
+
+/* The bits of set that are in mask, packed down to the low bits */
+static inline uint32_t compact(uint32_t set, uint32_t mask){
+#ifdef __BMI2__
+    return _pext_u32(set, mask);
+#else
+    uint32_t result = 0;
+    for (uint32_t bit = 1; mask; bit <<= 1, mask &= mask - 1){
+        if (set & mask & -mask) result |= bit;
+    }
+    return result;
+#endif
+}
+
+/* Spreads the low bits of set out over the bits of mask */
+static inline uint32_t expand(uint32_t set, uint32_t mask){
+#ifdef __BMI2__
+    return _pdep_u32(set, mask);
+#else
+    uint32_t result = 0;
+    for (uint32_t bit = 1; mask; bit <<= 1, mask &= mask - 1){
+        if (set & bit) result |= mask & -mask;
+    }
+    return result;
+#endif
+}
+
+/* Rank of a set of squares among all the sets of the same size, in colexicographic order */
+static inline uint64_t subset_rank(uint32_t set){
+    uint64_t rank = 0;
+    for (int i = 1; set; i++, set &= set - 1){
+        rank += choose(__builtin_ctz(set), i);
+    }
+    return rank;
+}
+
+static inline uint32_t subset_unrank(uint64_t rank, int size){
+    uint32_t set = 0;
+    for (int i = size; i > 0; i--){
+        int square = i - 1;
+        while (choose(square + 1, i) <= rank) square++;
+        rank -= choose(square, i);
+        set |= S[square];
+    }
+    return set;
+}
+
+/* Number of ways to place the men when k black men are off the first rank */
+static inline uint64_t men_count(const egdb_slice &slice, int k){
+    return choose(4, slice.men[BLACK] - k) * choose(24, k) * choose(28 - k, slice.men[WHITE]);
+}
+
+static inline int min_high_men(const egdb_slice &slice){
+    return std::max(0, slice.men[BLACK] - 4);
+}
+
+static inline uint64_t king_count(const egdb_slice &slice){
+    int empty = 32 - slice.men[BLACK] - slice.men[WHITE];
+    return choose(empty, slice.kings[BLACK]) * choose(empty - slice.kings[BLACK], slice.kings[WHITE]);
+}
+
+/* Number of positions in the slice, counting each side to move */
+uint64_t egdb_slice::size() const{
+    uint64_t men_total = 0;
+    for (int k = min_high_men(*this); k <= std::min<int>(men[BLACK], 24); k++) men_total += men_count(*this, k);
+    return men_total * king_count(*this) * 2;
+}
+
+/* The index of a position, which must belong to the slice */
+uint64_t egdb_slice::index(const Bitboards &bb) const{
+    const uint32_t black_men = bb.pieces[BLACK] & ~bb.kings;
+    const uint32_t white_men = bb.pieces[WHITE] & ~bb.kings;
+    const uint32_t high_men = black_men & BLACK_MAN_SQUARES;
+    const int k = count_bits(high_men);
+
+    uint64_t men_index = 0;
+    for (int j = min_high_men(*this); j < k; j++) men_index += men_count(*this, j);
+    men_index += (subset_rank(compact(black_men, FIRST_RANK)) * choose(24, k) + subset_rank(compact(high_men, BLACK_MAN_SQUARES)))
+               * choose(28 - k, men[WHITE])
+               + subset_rank(compact(white_men, WHITE_MAN_SQUARES & ~high_men));
+
+    const uint32_t empty = ~(black_men | white_men);
+    const uint32_t black_kings = bb.pieces[BLACK] & bb.kings;
+    const int free_squares = 32 - men[BLACK] - men[WHITE];
+    uint64_t king_index = subset_rank(compact(black_kings, empty)) * choose(free_squares - kings[BLACK], kings[WHITE])
+                        + subset_rank(compact(bb.pieces[WHITE] & bb.kings, empty & ~black_kings));
+
+    return (men_index * king_count(*this) + king_index) * 2 + bb.stm;
+}
+
+/* The position with the given index */
+Bitboards egdb_slice::position(uint64_t index) const{
+    Bitboards bb;
+    bb.stm = index & 1;
+    index >>= 1;
+
+    const uint64_t kings_total = king_count(*this);
+    uint64_t king_index = index % kings_total;
+    uint64_t men_index = index / kings_total;
+
+    int k = min_high_men(*this);
+    while (men_index >= men_count(*this, k)) men_index -= men_count(*this, k++);
+
+    const uint64_t white_ways = choose(28 - k, men[WHITE]);
+    const uint64_t black_index = men_index / white_ways;
+    const uint32_t high_men = expand(subset_unrank(black_index % choose(24, k), k), BLACK_MAN_SQUARES);
+    const uint32_t black_men = expand(subset_unrank(black_index / choose(24, k), men[BLACK] - k), FIRST_RANK) | high_men;
+    const uint32_t white_men = expand(subset_unrank(men_index % white_ways, men[WHITE]), WHITE_MAN_SQUARES & ~high_men);
+
+    const uint32_t empty = ~(black_men | white_men);
+    const int free_squares = 32 - men[BLACK] - men[WHITE];
+    const uint64_t white_king_ways = choose(free_squares - kings[BLACK], kings[WHITE]);
+    const uint32_t black_kings = expand(subset_unrank(king_index / white_king_ways, kings[BLACK]), empty);
+    const uint32_t white_kings = expand(subset_unrank(king_index % white_king_ways, kings[WHITE]), empty & ~black_kings);
+
+    bb.pieces[BLACK] = black_men | black_kings;
+    bb.pieces[WHITE] = white_men | white_kings;
+    bb.kings = black_kings | white_kings;
+    return bb;
+}
+
+std::string egdb_slice::file_name() const{
+    char name[32];
+    snprintf(name, sizeof(name), "%d%d%d%d" EGDB_EXT, men[BLACK], kings[BLACK], men[WHITE], kings[WHITE]);
+    return name;
+}
+
+egdb_slice egdb_slice::of(const Bitboards &bb){
+    egdb_slice slice;
+    for (int color = 0; color < 2; color++){
+        slice.kings[color] = count_bits(bb.pieces[color] & bb.kings);
+        slice.men[color] = count_bits(bb.pieces[color]) - slice.kings[color];
+    }
+    return slice;
+}
+
+/*
+All slices with both sides on the board and at most max_pieces pieces, in an
+order where every slice comes after the slices its moves can lead to: captures
+lead to slices with fewer pieces, and promotions to slices with fewer men.
+*/
+std::vector<egdb_slice> egdb_slices(int max_pieces){
+    std::vector<egdb_slice> slices;
+
+    for (int pieces = 2; pieces <= max_pieces; pieces++){
+        for (int men = 0; men <= pieces; men++){
+            for (int black_men = 0; black_men <= std::min(men, 12); black_men++){
+                int white_men = men - black_men;
+                if (white_men > 12) continue;
+
+                for (int black_kings = 0; black_kings <= pieces - men; black_kings++){
+                    int white_kings = pieces - men - black_kings;
+                    if (!(black_men + black_kings) || !(white_men + white_kings)) continue;
+                    if (black_men + black_kings > 12 || white_men + white_kings > 12) continue;
+
+                    slices.push_back({{(uint8_t)black_men, (uint8_t)white_men}, {(uint8_t)black_kings, (uint8_t)white_kings}});
+                }
+            }
+        }
+    }
+    return slices;
+}
+
+struct egdb_header{
+    uint32_t magic;
+    uint8_t men[2];
+    uint8_t kings[2];
+    uint64_t size;
+    uint32_t block_count;
+    uint32_t block_bytes;
+};
+
+static bool header_matches(const egdb_header &header, const egdb_slice &slice){
+    return header.magic == EGDB_MAGIC && header.size == slice.size() && header.block_bytes == EGDB_BLOCK_BYTES
+        && header.block_count == (header.size + 4 * EGDB_BLOCK_BYTES - 1) / (4 * EGDB_BLOCK_BYTES)
+        && header.men[BLACK] == slice.men[BLACK] && header.men[WHITE] == slice.men[WHITE]
+        && header.kings[BLACK] == slice.kings[BLACK] && header.kings[WHITE] == slice.kings[WHITE];
+}
+
+/* Run length codes a block, as described with EGDB_BLOCK_BYTES */
+static void compress_block(const uint8_t * in, size_t length, std::vector<uint8_t> &out){
+    size_t i = 0;
+    while (i < length){
+        size_t run = 1;
+        while (i + run < length && run < 130 && in[i + run] == in[i]) run++;
+        if (run >= 3){
+            out.push_back(run + 125);
+            out.push_back(in[i]);
+            i += run;
+            continue;
+        }
+
+        /* Copy bytes up to the next run worth coding */
+        size_t start = i;
+        while (i < length && i - start < 128){
+            if (i + 2 < length && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i++;
+        }
+        out.push_back(i - start - 1);
+        out.insert(out.end(), in + start, in + i);
+    }
+}
+
+/*
+Undoes compress_block.
+
+@return
+   false if the block is damaged
+*/
+static bool decompress_block(const uint8_t * in, const uint8_t * end, uint8_t * out, size_t length){
+    size_t done = 0;
+    while (done < length && in < end){
+        uint8_t control = *in++;
+        if (control < 128){
+            size_t count = control + 1;
+            if (done + count > length || in + count > end) return false;
+            memcpy(out + done, in, count);
+            in += count;
+            done += count;
+        }
+        else{
+            size_t count = control - 125;
+            if (done + count > length || in >= end) return false;
+            memset(out + done, *in++, count);
+            done += count;
+        }
+    }
+    return done == length;
+}
+
+/* Writes the values of a slice to dir/file_name() */
+bool egdb_write(const std::string &dir, const egdb_slice &slice, const std::vector<uint8_t> &values){
+    std::string path = dir + "/" + slice.file_name();
+    FILE * file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    egdb_header header = {EGDB_MAGIC, {slice.men[BLACK], slice.men[WHITE]}, {slice.kings[BLACK], slice.kings[WHITE]}, slice.size(), 0, EGDB_BLOCK_BYTES};
+    header.block_count = (values.size() + EGDB_BLOCK_BYTES - 1) / EGDB_BLOCK_BYTES;
+
+    std::vector<uint64_t> offsets = {0};
+    std::vector<uint8_t> data;
+    for (size_t begin = 0; begin < values.size(); begin += EGDB_BLOCK_BYTES){
+        compress_block(&values[begin], std::min<size_t>(EGDB_BLOCK_BYTES, values.size() - begin), data);
+        offsets.push_back(data.size());
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size()
+           && fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+/*
+Reads and decompresses all the values of a slice written by egdb_write.
+
+@return
+   false if the file is missing or doesn't hold the slice
+*/
+bool egdb_read(const std::string &dir, const egdb_slice &slice, std::vector<uint8_t> &values){
+    std::string path = dir + "/" + slice.file_name();
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    egdb_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header_matches(header, slice);
+    std::vector<uint64_t> offsets(ok ? header.block_count + 1 : 0);
+    ok = ok && fread(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size();
+    std::vector<uint8_t> data(ok ? offsets.back() : 0);
+    ok = ok && fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    if (!ok) return false;
+
+    values.assign((slice.size() + 3) / 4, 0);
+    for (uint32_t b = 0; b < header.block_count; b++){
+        size_t begin = (size_t)b * EGDB_BLOCK_BYTES;
+        if (offsets[b] > offsets[b + 1] || offsets[b + 1] > data.size()) return false;
+        if (!decompress_block(&data[offsets[b]], &data[0] + offsets[b + 1], &values[begin], std::min<size_t>(EGDB_BLOCK_BYTES, values.size() - begin)))
+            return false;
+    }
+    return true;
+}
+
+egdb_probe egdb;
+
+egdb_probe::~egdb_probe(){
+    close();
+}
+
+void egdb_probe::close(){
+    for (auto &entry : slices) munmap(entry.second.map, entry.second.length);
+    slices.clear();
+    for (cache_shard &shard : shards){
+        shard.blocks.clear();
+        shard.lookup.clear();
+    }
+    max_pieces = 0;
+}
+
+/*
+Maps a slice file into memory and checks that it holds the slice.
+
+@return
+   false if the file is missing or doesn't hold the slice
+*/
+bool egdb_probe::map_slice(const std::string &dir, const egdb_slice &slice){
+    std::string path = dir + "/" + slice.file_name();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    void * map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(egdb_header))
+        map = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const egdb_header &header = *(const egdb_header *)map;
+    mapped_slice mapped;
+    mapped.map = map;
+    mapped.length = info.st_size;
+    mapped.block_count = header.block_count;
+    mapped.data_bytes = (header.size + 3) / 4;
+    mapped.offsets = (const uint64_t *)((const uint8_t *)map + sizeof(egdb_header));
+    mapped.data = (const uint8_t *)(mapped.offsets + header.block_count + 1);
+
+    size_t table_end = sizeof(egdb_header) + (header.block_count + 1) * sizeof(uint64_t);
+    if (!header_matches(header, slice) || table_end > mapped.length || mapped.offsets[header.block_count] > mapped.length - table_end){
+        munmap(map, mapped.length);
+        return false;
+    }
+    slices[slice.key()] = mapped;
+    return true;
+}
+
+/*
+Maps every slice file in the directory, up to the most pieces for which all the
+slices are there.
+
+@return
+   the most pieces that can be probed, 0 if there are no databases
+*/
+int egdb_probe::open(const std::string &dir, size_t cache_mb){
+    close();
+
+    int pieces = 2;
+    for (; pieces <= 24; pieces++){
+        bool complete = true;
+        for (const egdb_slice &slice : egdb_slices(pieces)){
+            if (slice.pieces() == pieces && !map_slice(dir, slice)) complete = false;
+        }
+        if (!complete) break;
+    }
+    max_pieces = pieces - 1;
+    if (max_pieces < 2){
+        close();
+        return 0;
+    }
+
+    size_t blocks = std::max<size_t>(cache_mb * 1024 * 1024 / sizeof(cache_block) / EGDB_CACHE_SHARDS, 1);
+    for (cache_shard &shard : shards){
+        shard.blocks.resize(blocks);
+        for (cache_block &block : shard.blocks) block.id = UINT64_MAX;
+        shard.lookup.reserve(blocks);
+    }
+
+    std::cout << "Loaded endgame databases up to " << max_pieces << " pieces from " << dir << "\n";
+    return max_pieces;
+}
+
+/*
+Finds a block in the cache, decompressing it over the least recently used block if
+it isn't there. The lock of the shard must be held.
+
+@return
+   the values of the block, or nullptr if the block is damaged
+*/
+const uint8_t * egdb_probe::load_block(cache_shard &shard, int key, uint32_t block){
+    const uint64_t id = (uint64_t)key << 32 | block;
+    auto found = shard.lookup.find(id);
+    if (found != shard.lookup.end()){
+        shard.blocks.splice(shard.blocks.begin(), shard.blocks, found->second);
+        return found->second->values;
+    }
+
+    const mapped_slice &slice = slices.at(key);
+    auto oldest = std::prev(shard.blocks.end());
+    if (oldest->id != UINT64_MAX) shard.lookup.erase(oldest->id);
+    oldest->id = UINT64_MAX;
+
+    size_t begin = (size_t)block * EGDB_BLOCK_BYTES;
+    size_t length = std::min<size_t>(EGDB_BLOCK_BYTES, slice.data_bytes - begin);
+    if (slice.offsets[block] > slice.offsets[block + 1] || slice.offsets[block + 1] > slice.offsets[slice.block_count]) return nullptr;
+    if (!decompress_block(slice.data + slice.offsets[block], slice.data + slice.offsets[block + 1], oldest->values, length))
+        return nullptr;
+
+    oldest->id = id;
+    shard.blocks.splice(shard.blocks.begin(), shard.blocks, oldest);
+    shard.lookup[id] = oldest;
+    return oldest->values;
+}
+
+/*
+Looks up the value of a position for the side to move.
+
+@return
+   EGDB_UNKNOWN if the position isn't in the databases
+*/
+egdb_value egdb_probe::probe(const Bitboards &bb){
+    if (!bb.pieces[BLACK] || !bb.pieces[WHITE]) return EGDB_UNKNOWN;
+
+    const egdb_slice slice = egdb_slice::of(bb);
+    if (slice.pieces() > max_pieces) return EGDB_UNKNOWN;
+    const int key = slice.key();
+    if (!slices.count(key)) return EGDB_UNKNOWN;
+
+    const uint64_t index = slice.index(bb);
+    const uint32_t block = (index >> 2) / EGDB_BLOCK_BYTES;
+    cache_shard &shard = shards[(key * 31 + block) % EGDB_CACHE_SHARDS];
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    const uint8_t * values = load_block(shard, key, block);
+    if (!values) return EGDB_UNKNOWN;
+    return egdb_get(values, index - (uint64_t)block * EGDB_BLOCK_BYTES * 4);
+}
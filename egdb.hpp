@@ -0,0 +1,123 @@
+#pragma once
+
+#include "board.hpp"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Endgame databases. A slice is every position with a given number of black men,
+black kings, white men and white kings, with either side to move. Each position
+of a slice has a number between 0 and size() - 1 (a perfect index), and the
+slice stores a win, loss or draw for the side to move in 2 bits per position.
+
+Values are game theoretic: repetitions and the move rule are not taken into
+account, so a won position may take longer to win than the move rule allows.
+
+Positions are indexed in this order, each a subset of the squares that are left:
+   the black men on the first rank (squares 0-3)
+   the black men on squares 4-27 (black men never stand on the last rank)
+   the white men on squares 4-31 that no black man stands on
+   the black kings, then the white kings, on the empty squares
+   the side to move
+*/
+#define EGDB_MAGIC 0x42444745 // "EGDB"
+#define EGDB_EXT   ".wld"
+#define EGDB_DIR   "egdb"
+
+/*
+Files are compressed in blocks of EGDB_BLOCK_BYTES bytes of values, so that a
+single value can be read by decompressing one block. A file is a header, the
+offset of each block from the start of the data and one past the last, and
+the blocks. Blocks are run length coded: a control byte c below 128 is
+followed by c + 1 bytes to copy, and one of 128 or more by a byte to repeat
+c - 125 times.
+*/
+#define EGDB_BLOCK_BYTES 1024
+
+/* Values are from the point of view of the side to move */
+enum egdb_value : uint8_t {
+    EGDB_UNKNOWN,
+    EGDB_WIN,
+    EGDB_LOSS,
+    EGDB_DRAW
+};
+
+struct egdb_slice{
+    uint8_t men[2];
+    uint8_t kings[2];
+
+    inline int pieces() const { return men[BLACK] + men[WHITE] + kings[BLACK] + kings[WHITE]; }
+
+    /* A key that tells slices apart, used to name their files */
+    inline int key() const { return men[BLACK] * 1000 + kings[BLACK] * 100 + men[WHITE] * 10 + kings[WHITE]; }
+
+    uint64_t size() const;
+    uint64_t index(const Bitboards &bb) const;
+    Bitboards position(uint64_t index) const;
+    std::string file_name() const;
+
+    static egdb_slice of(const Bitboards &bb);
+};
+
+/* 2 bit values, 4 to a byte with the first in the lowest bits */
+inline egdb_value egdb_get(const uint8_t * values, uint64_t index){
+    return (egdb_value)((values[index >> 2] >> ((index & 3) * 2)) & 3);
+}
+
+std::vector<egdb_slice> egdb_slices(int max_pieces);
+bool egdb_write(const std::string &dir, const egdb_slice &slice, const std::vector<uint8_t> &values);
+bool egdb_read(const std::string &dir, const egdb_slice &slice, std::vector<uint8_t> &values);
+
+/*
+Looks positions up in the databases from search. The slice files are memory
+mapped, and blocks are decompressed when they are first needed into a cache
+that drops the least recently used blocks. The cache is split into shards with
+a lock each, so that many search threads can probe at once.
+*/
+#define EGDB_CACHE_SHARDS 64
+#define EGDB_CACHE_MB     32
+
+class egdb_probe{
+    public:
+        ~egdb_probe();
+
+        int open(const std::string &dir, size_t cache_mb = EGDB_CACHE_MB);
+        void close();
+        egdb_value probe(const Bitboards &bb);
+
+        /* Every position with at most this many pieces can be probed */
+        inline int pieces() const { return max_pieces; }
+
+    private:
+        struct mapped_slice{
+            void * map;
+            size_t length;
+            uint32_t block_count;
+            uint64_t data_bytes;     // bytes of values before compression
+            const uint64_t * offsets;
+            const uint8_t * data;
+        };
+
+        struct cache_block{
+            uint64_t id;             // slice key and block number, or UINT64_MAX if unused
+            uint8_t values[EGDB_BLOCK_BYTES];
+        };
+
+        struct cache_shard{
+            std::mutex lock;
+            std::list<cache_block> blocks;  // most recently used first
+            std::unordered_map<uint64_t, std::list<cache_block>::iterator> lookup;
+        };
+
+        std::unordered_map<int, mapped_slice> slices;
+        cache_shard shards[EGDB_CACHE_SHARDS];
+        int max_pieces = 0;
+
+        bool map_slice(const std::string &dir, const egdb_slice &slice);
+        const uint8_t * load_block(cache_shard &shard, int key, uint32_t block);
+} extern egdb;
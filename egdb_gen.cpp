@@ -0,0 +1,312 @@
+#include "egdb.hpp"
+#include "board.hpp"
+#include "transposition.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Builds the endgame databases by retrograde analysis, one slice at a time, in
+an order where the slices that captures and promotions lead to are built first.
+
+A slice starts with every position worked out from its moves alone: no moves is
+a loss, and moves that leave the slice are looked up in the slices built before.
+The positions that become wins or losses form the first frontier. After that,
+only the positions that can lead to a frontier position are looked at. They are
+found by running the move masks of Bitboards backwards: if the frontier position
+is a loss for the side to move, its predecessors are wins; if it is a win, a
+predecessor is a loss once all of its moves are known to lead to wins. The new
+wins and losses are the next frontier, and what is left when the frontier runs
+out is drawn.
+
+Threads share the work of each pass in blocks of positions. Values only ever go
+from unknown to known, and are set with compare and swap.
+*/
+
+const uint64_t BLOCK_SIZE = 4096;
+
+/* Runs work(begin, end) over [0, count) in blocks, on all threads */
+void parallel_for(int threads, uint64_t count, const std::function<void(uint64_t, uint64_t)> &work){
+    std::atomic<uint64_t> next{0};
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++){
+        workers.emplace_back([&](){
+            uint64_t begin;
+            while ((begin = next.fetch_add(BLOCK_SIZE)) < count){
+                work(begin, std::min(begin + BLOCK_SIZE, count));
+            }
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+}
+
+struct slice_builder{
+    const egdb_slice slice;
+    const std::map<int, std::vector<uint8_t>> &built;
+    const int threads;
+    const uint64_t size;
+
+    std::vector<std::atomic<uint32_t>> values;   // 16 values to a word
+    std::vector<std::atomic<uint64_t>> frontier; // positions that became wins or losses in the last pass
+    std::vector<std::atomic<uint64_t>> next_frontier;
+
+    slice_builder(const egdb_slice &slice, const std::map<int, std::vector<uint8_t>> &built, int threads)
+        : slice(slice), built(built), threads(threads), size(slice.size()),
+          values((size + 15) / 16), frontier((size + 63) / 64), next_frontier((size + 63) / 64)
+    {
+        for (auto &word : values) word = 0;
+        for (auto &word : frontier) word = 0;
+        for (auto &word : next_frontier) word = 0;
+    }
+
+    inline egdb_value get(uint64_t index) const{
+        return (egdb_value)((values[index >> 4].load(std::memory_order_relaxed) >> ((index & 15) * 2)) & 3);
+    }
+
+    /* Sets an unknown value. Returns false if the position already had one. */
+    inline bool set(uint64_t index, egdb_value value){
+        std::atomic<uint32_t> &word = values[index >> 4];
+        const int shift = (index & 15) * 2;
+        uint32_t old = word.load(std::memory_order_relaxed);
+        do {
+            if ((old >> shift) & 3) return false;
+        } while (!word.compare_exchange_weak(old, old | ((uint32_t)value << shift), std::memory_order_relaxed));
+        return true;
+    }
+
+    /* The value of a position after a move, from the point of view of its side to move */
+    egdb_value child_value(const Bitboards &bb) const{
+        if (!bb.pieces[bb.stm]) return EGDB_LOSS;
+
+        egdb_slice child = egdb_slice::of(bb);
+        if (child.key() == slice.key()) return get(slice.index(bb));
+        return egdb_get(built.at(child.key()).data(), child.index(bb));
+    }
+
+    /*
+    Works out the value of a position from the values of the positions its moves lead to.
+
+    @return
+       EGDB_UNKNOWN if that isn't possible yet
+    */
+    egdb_value evaluate(Board &board, const Bitboards &bb) const{
+        Move moves[MAX_MOVES];
+        board.set_position(bb);
+        int count = board.gen_moves(moves, (char)-1);
+        egdb_value best = EGDB_LOSS;
+
+        for (int i = 0; i < count; i++){
+            uint32_t kings = board.bb.kings;
+            board.push_move(moves[i]);
+            egdb_value value = child_value(board.bb);
+            board.undo(moves[i], kings);
+
+            if (value == EGDB_LOSS) return EGDB_WIN;
+            if (value == EGDB_UNKNOWN) best = EGDB_UNKNOWN;
+            else if (value == EGDB_DRAW && best == EGDB_LOSS) best = EGDB_DRAW;
+        }
+        return best;
+    }
+
+    /*
+    Calls found with the index of every position of the slice that leads to this one with
+    a single quiet move. Captures and promotions always come from other slices.
+    */
+    template <typename F>
+    void predecessors(const Bitboards &bb, F found) const{
+        const int mover = !bb.stm;
+        const uint32_t empty = ~bb.all_pieces();
+        uint32_t pieces = bb.pieces[mover];
+
+        while (pieces){
+            const uint32_t to = pieces & -pieces;
+            pieces &= pieces - 1;
+
+            const bool is_king = to & bb.kings;
+            uint32_t from = 0;
+            if (is_king || mover == BLACK) from |= ((to & MASK_R3) >> 3) | ((to & MASK_R5) >> 5) | (to >> 4);
+            if (is_king || mover == WHITE) from |= ((to & MASK_L3) << 3) | ((to & MASK_L5) << 5) | (to << 4);
+            from &= empty;
+
+            while (from){
+                const uint32_t origin = from & -from;
+                from &= from - 1;
+
+                Bitboards prev = bb;
+                prev.pieces[mover] ^= to | origin;
+                if (is_king) prev.kings ^= to | origin;
+                prev.stm = mover;
+
+                /* The move wasn't legal if there was a capture to make instead */
+                if (mover ? prev.get_white_jumpers() : prev.get_black_jumpers()) continue;
+                found(slice.index(prev));
+            }
+        }
+    }
+
+    inline void add_to_frontier(uint64_t index){
+        next_frontier[index >> 6].fetch_or((uint64_t)1 << (index & 63), std::memory_order_relaxed);
+    }
+
+    /* Moves the next frontier into the current one. Returns its size. */
+    uint64_t swap_frontiers(){
+        uint64_t count = 0;
+        for (size_t i = 0; i < frontier.size(); i++){
+            uint64_t word = next_frontier[i].exchange(0, std::memory_order_relaxed);
+            frontier[i].store(word, std::memory_order_relaxed);
+            count += __builtin_popcountll(word);
+        }
+        return count;
+    }
+
+    /*
+    Finds the value of every position in the slice.
+
+    @return
+       the number of passes over the frontier
+    */
+    int build(){
+        parallel_for(threads, size, [&](uint64_t begin, uint64_t end){
+            Board board;
+            for (uint64_t i = begin; i < end; i++){
+                egdb_value value = evaluate(board, slice.position(i));
+                if (value == EGDB_UNKNOWN) continue;
+                set(i, value);
+                if (value != EGDB_DRAW) add_to_frontier(i);
+            }
+        });
+
+        int passes = 0;
+        while (swap_frontiers()){
+            passes++;
+
+            /* Blocks are of frontier words, 64 positions each */
+            parallel_for(threads, frontier.size(), [&](uint64_t begin, uint64_t end){
+                Board board;
+                for (uint64_t w = begin; w < end; w++){
+                    uint64_t word = frontier[w].load(std::memory_order_relaxed);
+                    while (word){
+                        const uint64_t index = w * 64 + __builtin_ctzll(word);
+                        word &= word - 1;
+
+                        const bool is_loss = get(index) == EGDB_LOSS;
+                        predecessors(slice.position(index), [&](uint64_t prev){
+                            if (get(prev) != EGDB_UNKNOWN) return;
+
+                            if (is_loss){
+                                if (set(prev, EGDB_WIN)) add_to_frontier(prev);
+                            }
+                            else if (evaluate(board, slice.position(prev)) == EGDB_LOSS){
+                                if (set(prev, EGDB_LOSS)) add_to_frontier(prev);
+                            }
+                        });
+                    }
+                }
+            });
+        }
+        return passes;
+    }
+
+    /* The values packed 4 to a byte, with the positions that are still unknown drawn */
+    std::vector<uint8_t> result() const{
+        std::vector<uint8_t> packed((size + 3) / 4, 0);
+        for (uint64_t i = 0; i < size; i++){
+            egdb_value value = get(i);
+            if (value == EGDB_UNKNOWN) value = EGDB_DRAW;
+            packed[i >> 2] |= value << ((i & 3) * 2);
+        }
+        return packed;
+    }
+};
+
+/*
+The slices the moves of a slice can lead to, besides itself. A capture takes any
+number of the opponent's men and kings, and a capture or a quiet move can make a
+king of a man. Slices where the opponent has no pieces left aren't stored.
+*/
+std::vector<egdb_slice> child_slices(const egdb_slice &slice){
+    std::map<int, egdb_slice> children;
+
+    for (int mover = 0; mover < 2; mover++){
+        const int other = !mover;
+        for (int men = 0; men <= slice.men[other]; men++){
+            for (int kings = 0; kings <= slice.kings[other]; kings++){
+                for (int promo = 0; promo <= std::min<int>(slice.men[mover], 1); promo++){
+                    egdb_slice child = slice;
+                    child.men[other] -= men;
+                    child.kings[other] -= kings;
+                    child.men[mover] -= promo;
+                    child.kings[mover] += promo;
+                    if ((child.men[other] || child.kings[other]) && child.key() != slice.key()) children[child.key()] = child;
+                }
+            }
+        }
+    }
+
+    std::vector<egdb_slice> result;
+    for (auto &child : children) result.push_back(child.second);
+    return result;
+}
+
+int main(){
+    set_hash_function();
+    init_psq();
+
+    int max_pieces, threads;
+    std::string dir;
+
+    std::cout << "most pieces: ";
+    std::cin >> max_pieces;
+    std::cout << "threads (0 for all cores): ";
+    std::cin >> threads;
+    std::cout << "output directory: ";
+    std::cin >> dir;
+    std::cout << "\n";
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::map<int, std::vector<uint8_t>> built;
+    uint64_t start = get_time();
+
+    for (const egdb_slice &slice : egdb_slices(max_pieces)){
+        uint64_t slice_start = get_time();
+
+        /*
+        Only the slices this one leads to are kept in memory. Any that were let go are
+        read back from the files written before.
+        */
+        std::map<int, std::vector<uint8_t>> needed;
+        for (const egdb_slice &child : child_slices(slice)){
+            auto found = built.find(child.key());
+            if (found != built.end()) needed[child.key()] = std::move(found->second);
+            else if (!egdb_read(dir, child, needed[child.key()])){
+                std::cout << "could not read " << dir << "/" << child.file_name() << "\n";
+                return 1;
+            }
+        }
+        built = std::move(needed);
+
+        slice_builder builder(slice, built, threads);
+        int passes = builder.build();
+        std::vector<uint8_t> values = builder.result();
+
+        uint64_t counts[4] = {0, 0, 0, 0};
+        for (uint64_t i = 0; i < builder.size; i++) counts[egdb_get(values.data(), i)]++;
+
+        std::cout << slice.file_name() << ": " << builder.size << " positions, +" << counts[EGDB_WIN] << " -" << counts[EGDB_LOSS]
+                  << " =" << counts[EGDB_DRAW] << ", " << passes << " passes, " << get_time() - slice_start << " ms\n";
+
+        if (!egdb_write(dir, slice, values)){
+            std::cout << "could not write " << dir << "/" << slice.file_name() << "\n";
+            return 1;
+        }
+        built[slice.key()] = std::move(values);
+    }
+    std::cout << "\ndone in " << get_time() - start << " ms\n";
+}
@@ -4,8 +4,19 @@
 
 #include <iostream>
 
+enum eSearchType {
+    TIME_SEARCH,
+    DEPTH_SEARCH,
+    CLOCK_SEARCH
+};
+
 int main(){
     set_hash_function();
+    weights.load(WEIGHTS_FILE);
+    init_psq();
+    nnue_load(NNUE_FILE);
+    egdb.open(EGDB_DIR);
+    book.open(BOOK_FILE);
     Board board;
     std::vector<Move> move_history;
     std::vector<uint32_t> king_history;
@@ -15,18 +26,30 @@ int main(){
     int cpu_depth = 10;
     double t = 1;
     bool undone = false;
-    bool is_depth_search = true;
+    int search_type = DEPTH_SEARCH;
     bool is_cpu_game = false;
+    bool ponder = false;
+    bool ponder_hit = false;
+    game_clock clocks[2];
 
     std::cout << "Play as Black(0) or White(1) (or 2 to have the cpu play itself): ";
     std::cin >> player_color;
-    std::cout << "\nTime Search(0) or Depth Search(1)?: ";
-    std::cin >> is_depth_search;
+    std::cout << "\nTime Search(0), Depth Search(1) or Game Clock(2)?: ";
+    std::cin >> search_type;
 
-    if (is_depth_search){
+    if (search_type == DEPTH_SEARCH){
         std::cout << "\ncpu max depth: ";
         std::cin >> cpu_depth;
     }
+    else if (search_type == CLOCK_SEARCH){
+        double minutes, increment;
+        std::cout << "\nminutes per game: ";
+        std::cin >> minutes;
+        std::cout << "increment (seconds): ";
+        std::cin >> increment;
+        clocks[BLACK].remaining = clocks[WHITE].remaining = minutes * 60000;
+        clocks[BLACK].increment = clocks[WHITE].increment = increment * 1000;
+    }
     else{
         std::cout << "\ntime limit for cpu (seconds): ";
         std::cin >> t;
@@ -37,6 +60,11 @@ int main(){
         is_cpu_game = true;
         player_color = 1;
     }
+    else if (search_type != DEPTH_SEARCH){
+        std::cout << "Let the cpu think on your time (0/1)?: ";
+        std::cin >> ponder;
+        std::cout << "\n";
+    }
     cpu cpu1(1 - player_color, cpu_depth);
     cpu cpu2(player_color, cpu_depth);
 
@@ -56,8 +84,15 @@ int main(){
             std::cin >> x;
             if ((0 <= x) && (x < movecount)){
                 m = movelist[x];
+
+                /* If the cpu guessed this move, its background search carries on */
+                if (cpu1.is_pondering()){
+                    if (m.same_as(cpu1.ponder_move)) ponder_hit = true;
+                    else                             cpu1.stop_ponder();
+                }
             }
             else{
+                cpu1.stop_ponder();
                 std::cout << move_history.size() << " moves recorded\n";
                 if (move_history.size() >= 1){
                     board.undo(move_history[move_history.size() - 1], king_history[king_history.size() - 2]);
@@ -79,18 +114,32 @@ int main(){
             // }
         }
         else{
-            if (is_depth_search){
+            if (search_type == DEPTH_SEARCH){
                 m = cpu1.max_depth_search(board, true);
             }
+            else if (search_type == CLOCK_SEARCH){
+                game_clock &clock = clocks[board.bb.stm];
+                m = ponder_hit ? cpu1.ponder_hit(clock) : cpu1.clock_search(board, clock);
+
+                /* Charge the time used, and stop at 0 rather than flagging */
+                uint64_t used = cpu1.tm.elapsed();
+                clock.remaining = (clock.remaining > used) ? clock.remaining - used : 0;
+                clock.remaining += clock.increment;
+                std::cout << "Clock: " << clock.remaining / 1000.0 << " seconds left\n";
+            }
             else{
-                m = cpu1.time_search(board, t);
+                m = ponder_hit ? cpu1.ponder_hit(t) : cpu1.time_search(board, t);
             }
+            ponder_hit = false;
         }
 
         if (!undone) {
             board.push_move(m);
             move_history.push_back(m);
             king_history.push_back(board.bb.kings);
+
+            if (ponder && board.bb.stm == player_color)
+                cpu1.start_ponder(board);
         }
         undone = false;
         movecount = board.gen_moves(movelist, (char)-1);
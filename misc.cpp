@@ -23,7 +23,7 @@ void print_binary(uint32_t num){
    std::cout << std::bitset<32>(num) << "\n";
 }
 
-//returns time in milliseconds
+//returns time in milliseconds from a monotonic clock, so only differences are meaningful
 uint64_t get_time(){
-   return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+   return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
\ No newline at end of file
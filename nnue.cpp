@@ -0,0 +1,93 @@
+#include "nnue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+nnue_weights nnue;
+bool nnue_loaded = false;
+
+/*
+Reads a network from a file. Must be called before any boards that
+will be evaluated with it are made.
+
+@return
+   false if the file is missing or isn't a complete network
+*/
+bool nnue_load(const char * path){
+    FILE * file = fopen(path, "rb");
+    if (!file) return false;
+
+    uint32_t magic = 0;
+    bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == NNUE_MAGIC
+           && fread(nnue.input_weights, sizeof(nnue.input_weights), 1, file) == 1
+           && fread(nnue.input_bias, sizeof(nnue.input_bias), 1, file) == 1
+           && fread(nnue.output_weights, sizeof(nnue.output_weights), 1, file) == 1
+           && fread(nnue.output_bias, sizeof(nnue.output_bias), 1, file) == 1;
+    fclose(file);
+
+    nnue_loaded = ok;
+    if (ok) std::cout << "Loaded network " << path << "\n";
+    else    std::cout << "Could not read network " << path << "\n";
+    return ok;
+}
+
+/* Computes the hidden sums of a position from scratch */
+void nnue_refresh(int16_t * accumulator, uint32_t black, uint32_t white, uint32_t kings){
+    std::copy(nnue.input_bias, nnue.input_bias + NNUE_HIDDEN, accumulator);
+
+    const uint32_t pieces[4] = {black & ~kings, white & ~kings, black & kings, white & kings};
+    for (int pt = 0; pt < 4; pt++){
+        uint32_t bb = pieces[pt];
+        while (bb){
+            nnue_add_feature(accumulator, nnue_feature(pt, __builtin_ctz(bb)));
+            bb &= bb - 1;
+        }
+    }
+}
+
+/*
+Runs the output layer on the hidden sums.
+
+@param stm
+   the side to move, which picks the output
+@return
+   the evaluation from the point of view of the side to move
+*/
+int nnue_evaluate(const int16_t * accumulator, int stm){
+    const int8_t * weights = nnue.output_weights[stm];
+    int32_t sum = nnue.output_bias[stm];
+
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(NNUE_ACTIVATION_MAX);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i total = _mm256_setzero_si256();
+
+    for (int i = 0; i < NNUE_HIDDEN; i += 32){
+        __m256i low = _mm256_load_si256((const __m256i *)&accumulator[i]);
+        __m256i high = _mm256_load_si256((const __m256i *)&accumulator[i + 16]);
+        low = _mm256_min_epi16(_mm256_max_epi16(low, zero), max);
+        high = _mm256_min_epi16(_mm256_max_epi16(high, zero), max);
+
+        /* Packing works within 128 bit lanes, so the quarters are put back in order after */
+        __m256i active = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+
+        /* Pairs of 8 bit products can't overflow 16 bits, since the activations are at most 127 */
+        __m256i products = _mm256_maddubs_epi16(active, _mm256_load_si256((const __m256i *)&weights[i]));
+        total = _mm256_add_epi32(total, _mm256_madd_epi16(products, ones));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    sum += _mm_cvtsi128_si32(half);
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++){
+        int active = std::min(std::max((int)accumulator[i], 0), NNUE_ACTIVATION_MAX);
+        sum += active * weights[i];
+    }
+#endif
+
+    return sum / NNUE_OUTPUT_DIVISOR;
+}
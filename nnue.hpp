@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+A small neural network evaluation. There is one input for each piece type on
+each square, in the same order as the hash function (type * 32 + square), a
+hidden layer whose sums are kept up to date by Board::push_move and undo, and
+one output for each side to move.
+
+The hidden sums are clipped to [0, 127] and multiplied by 8 bit output weights.
+The output is in the units of the handcrafted eval (75 per man) after dividing
+by NNUE_OUTPUT_DIVISOR, and is from the point of view of the side to move.
+*/
+#define NNUE_INPUTS          128
+#define NNUE_HIDDEN          128
+#define NNUE_ACTIVATION_MAX  127
+#define NNUE_OUTPUT_DIVISOR  32
+
+#define NNUE_FILE "checkers.nnue"
+
+/*
+Layout of a network file, all little endian and without padding: the magic
+number, then the arrays in the order they are declared.
+*/
+#define NNUE_MAGIC 0x4e4e4b43 // "CKNN"
+
+struct nnue_weights{
+    alignas(32) int16_t input_weights[NNUE_INPUTS][NNUE_HIDDEN];
+    alignas(32) int16_t input_bias[NNUE_HIDDEN];
+    alignas(32) int8_t output_weights[2][NNUE_HIDDEN];
+    int32_t output_bias[2];
+} extern nnue;
+
+/* Set once a network is loaded. Boards made before that have no valid hidden sums. */
+extern bool nnue_loaded;
+
+bool nnue_load(const char * path);
+void nnue_refresh(int16_t * accumulator, uint32_t black, uint32_t white, uint32_t kings);
+int nnue_evaluate(const int16_t * accumulator, int stm);
+
+inline int nnue_feature(int piecetype, int square){
+    return piecetype * 32 + square;
+}
+
+inline void nnue_add_feature(int16_t * accumulator, int feature){
+    const int16_t * weights = nnue.input_weights[feature];
+#ifdef __AVX2__
+    for (int i = 0; i < NNUE_HIDDEN; i += 16){
+        __m256i sum = _mm256_load_si256((const __m256i *)&accumulator[i]);
+        sum = _mm256_add_epi16(sum, _mm256_load_si256((const __m256i *)&weights[i]));
+        _mm256_store_si256((__m256i *)&accumulator[i], sum);
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++) accumulator[i] += weights[i];
+#endif
+}
+
+inline void nnue_remove_feature(int16_t * accumulator, int feature){
+    const int16_t * weights = nnue.input_weights[feature];
+#ifdef __AVX2__
+    for (int i = 0; i < NNUE_HIDDEN; i += 16){
+        __m256i sum = _mm256_load_si256((const __m256i *)&accumulator[i]);
+        sum = _mm256_sub_epi16(sum, _mm256_load_si256((const __m256i *)&weights[i]));
+        _mm256_store_si256((__m256i *)&accumulator[i], sum);
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; i++) accumulator[i] -= weights[i];
+#endif
+}
@@ -0,0 +1,251 @@
+/*
+Young brothers wait parallel search.
+
+A node is only shared out after its first move has been searched on its own, so
+the moves given to other threads are searched with a good bound, and the tree
+stays close to the one the serial search walks. Each thread keeps its open split
+points in a deque: the owner adds to and removes from the back, and idle threads
+steal from the front, where the split points closest to the root (and so with the
+most work left) are.
+
+A fail high at a split point sets its cutoff flag. Every thread searching below
+it, at any depth of nested split points, sees the flag through the parent links
+and abandons its work.
+
+The transposition table is shared without locks. Two threads writing the same
+slot can leave a mixed entry behind, which at worst gives a wrong bound, or a
+hash move that unpack_move rejects.
+*/
+#include "cpu.hpp"
+
+#define HELPER_EVAL_TABLE_SIZE 0x400000
+
+/* Makes a helper that searches for master_cpu and fills its transposition table */
+cpu::cpu(cpu * master_cpu){
+    master = master_cpu;
+    stop_flag = &master->search_cancelled;
+    options = master->options;
+    set_color(master->color);
+    max_depth = current_depth = master->max_depth;
+    table.share(master->table);
+    eval_table.set_size(HELPER_EVAL_TABLE_SIZE);
+    tm.init_infinite();
+    nodes_traversed = 0;
+    cont_history = new cont_table[2];
+    clear_heuristics();
+}
+
+/* Nodes searched by this cpu and all of its helpers */
+uint64_t cpu::total_nodes() const{
+    uint64_t nodes = nodes_traversed;
+    for (const cpu * helper : helpers) nodes += helper->nodes_traversed;
+    return nodes;
+}
+
+/* Quiescence nodes searched by this cpu and all of its helpers */
+uint64_t cpu::total_quiesce_nodes() const{
+    uint64_t nodes = quiesce_nodes;
+    for (const cpu * helper : helpers) nodes += helper->quiesce_nodes;
+    return nodes;
+}
+
+/* Endgame database hits of this cpu and all of its helpers */
+uint64_t cpu::total_egdb_hits() const{
+    uint64_t hits = egdb_hits;
+    for (const cpu * helper : helpers) hits += helper->egdb_hits;
+    return hits;
+}
+
+/* Starts or stops helper threads until there are as many threads as the options ask for */
+void cpu::start_helpers(){
+    int wanted = std::max(options.threads, 1) - 1;
+    if ((int)helpers.size() == wanted) return;
+
+    stop_helpers();
+    pool_quit = false;
+    for (int i = 0; i < wanted; i++) helpers.push_back(new cpu(this));
+    idle_helpers = wanted;
+    for (cpu * helper : helpers) helper->worker = std::thread(&cpu::idle_loop, helper);
+}
+
+void cpu::stop_helpers(){
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        pool_quit = true;
+    }
+    pool_wake.notify_all();
+
+    for (cpu * helper : helpers){
+        helper->worker.join();
+        delete helper;
+    }
+    helpers.clear();
+    idle_helpers = 0;
+}
+
+/* Wakes the helpers up at the start of a search, and sends them back to sleep at the end */
+void cpu::set_pool_searching(bool searching){
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        pool_searching = searching;
+    }
+    pool_wake.notify_all();
+}
+
+/* Runs on a helper thread. While a search is running, looks for split points to help with. */
+void cpu::idle_loop(){
+    while (true){
+        {
+            std::unique_lock<std::mutex> lock(master->pool_lock);
+            master->pool_wake.wait(lock, [this]{ return master->pool_searching || master->pool_quit; });
+            if (master->pool_quit) return;
+        }
+
+        split_point * sp = steal_split();
+        if (!sp){
+            std::this_thread::yield();
+            continue;
+        }
+
+        work_split(*sp);
+        sp->helpers--;
+        master->idle_helpers++;
+    }
+}
+
+/*
+Finds a split point of any thread that still has moves to give out, and joins it.
+The queue lock is held while joining, so the owner can't finish the split point
+between the check and the join.
+
+@return
+   the split point joined, or nullptr if there is no work
+*/
+split_point * cpu::steal_split(){
+    for (int t = -1; t < (int)master->helpers.size(); t++){
+        cpu * victim = (t < 0) ? master : master->helpers[t];
+        std::lock_guard<std::mutex> queue_guard(victim->split_queue_lock);
+
+        for (split_point * sp : victim->split_queue){
+            std::lock_guard<std::mutex> guard(sp->lock);
+            if (sp->next < sp->movecount && !sp->cut_off()){
+                sp->helpers++;
+                master->idle_helpers--;
+                return sp;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/*
+Shares the rest of the moves of a node with idle threads, and searches them
+together with the helpers until all are done or one of them fails high.
+
+@param moves
+   the moves not yet searched, in no particular order
+@param searched
+   a move that was searched before the moves were generated, and must not be searched again
+@return
+   the best value found, which is only above alpha if a move raised it. The best move
+   and, at PV nodes, the principal variation are updated to match.
+*/
+int cpu::split(Board &board, Move * moves, int count, const Move * searched, int depth, int ply,
+               int alpha, int beta, int is_pv, int moves_tried, int raised_alpha, packed_move &bestmove){
+    split_point sp;
+    sp.parent = active_split;
+    sp.board = board;
+    sp.depth = depth;
+    sp.ply = ply;
+    sp.beta = beta;
+    sp.is_pv = is_pv;
+    sp.movecount = 0;
+    sp.next = 0;
+    sp.moves_tried = moves_tried;
+    sp.alpha = alpha;
+    sp.raised_alpha = raised_alpha;
+    sp.bestmove = bestmove;
+    sp.pv_length = 0;
+    sp.prev_moves[0] = move_stack[ply];
+    if (ply > 0) sp.prev_moves[1] = move_stack[ply - 1];
+
+    /* The moves are handed out best first, in the same order the serial search would use */
+    for (int i = 0; i < count; i++){
+        order_moves(count, moves, i);
+        if (searched && moves[i].same_as(*searched)) continue;
+        sp.movelist[sp.movecount++] = moves[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(split_queue_lock);
+        split_queue.push_back(&sp);
+    }
+    split_count++;
+
+    work_split(sp);
+
+    /* Once the split point is out of the queue no new helper can join, so wait for the ones still there */
+    {
+        std::lock_guard<std::mutex> guard(split_queue_lock);
+        split_queue.erase(std::find(split_queue.begin(), split_queue.end(), &sp));
+    }
+    while (sp.helpers) std::this_thread::yield();
+
+    if (sp.alpha > alpha){
+        bestmove = sp.bestmove;
+        if (is_pv && ply + 1 < MAX_PLY){
+            pv_length[ply + 1] = sp.pv_length;
+            memcpy(pv_table[ply + 1], sp.pv, sp.pv_length * sizeof(Move));
+        }
+    }
+    return sp.alpha;
+}
+
+/* Takes moves from the split point and searches them until there are none left */
+void cpu::work_split(split_point &sp){
+    Board board = sp.board;
+    split_point * prev_split = active_split;
+    active_split = &sp;
+    follow_pv = false;
+    move_stack[sp.ply] = sp.prev_moves[0];
+    if (sp.ply > 0) move_stack[sp.ply - 1] = sp.prev_moves[1];
+
+    while (true){
+        sp.lock.lock();
+        if (sp.next >= sp.movecount || sp.cutoff){
+            sp.lock.unlock();
+            break;
+        }
+        Move m = sp.movelist[sp.next++];
+        int moves_tried = ++sp.moves_tried;
+        int alpha = sp.alpha;
+        int raised_alpha = sp.raised_alpha;
+        sp.lock.unlock();
+
+        int val = search_move(board, m, sp.depth, sp.ply, alpha, sp.beta, sp.is_pv, moves_tried, raised_alpha);
+        if (stopped()) break;
+
+        std::lock_guard<std::mutex> guard(sp.lock);
+        if (val <= sp.alpha || sp.cutoff) continue;
+
+        sp.alpha = val;
+        sp.raised_alpha = 1;
+        sp.bestmove = m.pack();
+        cutoff[m.color()][m.from][m.to] += options.lmr_cutoff_bonus;
+
+        /* The line from this thread's table, with the move in front */
+        if (sp.is_pv && sp.ply + 2 < MAX_PLY){
+            int length = std::min(pv_length[sp.ply + 2], MAX_PLY - 1);
+            sp.pv[0] = m;
+            memcpy(&sp.pv[1], pv_table[sp.ply + 2], length * sizeof(Move));
+            sp.pv_length = length + 1;
+        }
+
+        if (val >= sp.beta){
+            record_cutoff(m, sp.depth, sp.ply, nullptr, 0);
+            sp.cutoff = true;
+        }
+    }
+
+    active_split = prev_split;
+}
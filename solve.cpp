@@ -0,0 +1,74 @@
+#include "solver.hpp"
+#include "board.hpp"
+#include "transposition.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+/*
+Proves a position won, lost or drawn with the df-pn solver, and shows the line
+that the result rests on. The position is given as the black, white and king
+bitboards in hex followed by the side to move, or as "start".
+*/
+
+const char * RESULT_NAMES[] = {"unknown", "win", "draw", "loss"};
+
+int main(){
+    set_hash_function();
+    init_psq();
+    egdb.open(EGDB_DIR);
+
+    Board board;
+    std::string position;
+    size_t table_mb;
+    uint64_t node_limit;
+
+    std::cout << "position (start, or black white kings stm): ";
+    std::getline(std::cin, position);
+    std::cout << "table size (MB): ";
+    std::cin >> table_mb;
+    std::cout << "node limit (millions): ";
+    std::cin >> node_limit;
+    std::cout << "\n";
+
+    if (position != "start"){
+        Bitboards bb;
+        unsigned int black, white, kings, stm;
+        if (sscanf(position.c_str(), "%x %x %x %u", &black, &white, &kings, &stm) != 4 || stm > 1){
+            std::cout << "could not read the position\n";
+            return 1;
+        }
+        bb.pieces[BLACK] = black;
+        bb.pieces[WHITE] = white;
+        bb.kings = kings;
+        bb.stm = stm;
+        board.set_position(bb);
+    }
+
+    /* print shows whether the game is over from the moves that were generated last */
+    Move movelist[MAX_MOVES];
+    board.gen_moves(movelist, (char)-1);
+    board.print();
+
+    pn_solver solver(table_mb);
+    uint64_t start = get_time();
+    pn_result result = solver.solve(board, node_limit * 1000000);
+    uint64_t elapsed = std::max<uint64_t>(get_time() - start, 1);
+
+    std::cout << "\n" << (board.bb.stm ? "White" : "Black") << " to move: " << RESULT_NAMES[result] << "\n";
+    std::cout << solver.nodes << " nodes in " << elapsed << " ms, " << solver.nodes / elapsed << " knps\n";
+    if (solver.egdb_draws) std::cout << solver.egdb_draws << " database draws\n";
+    std::cout << "table " << solver.table.used * 100 / solver.table.capacity << "% full, "
+              << solver.table.collections << " collections\n";
+
+    if (!solver.line.empty()){
+        std::cout << "line:";
+        for (Move &m : solver.line){
+            std::cout << " ";
+            m.print_move_info();
+        }
+        std::cout << "\n";
+    }
+    return result == PN_UNKNOWN;
+}
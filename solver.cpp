@@ -0,0 +1,293 @@
+#include "solver.hpp"
+
+#include "transposition.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/* Sets the size of the table in megabytes, rounded down to a power of two entries */
+void pn_table::set_size(size_t mb){
+    free(entries);
+    capacity = PN_BUCKET;
+    while (capacity * 2 * sizeof(pn_entry) <= (mb << 20)) capacity *= 2;
+
+    entries = (pn_entry *)calloc(capacity, sizeof(pn_entry));
+    mask = capacity - PN_BUCKET;
+    used = 0;
+    collections = 0;
+}
+
+void pn_table::clear(){
+    memset(entries, 0, capacity * sizeof(pn_entry));
+    used = 0;
+}
+
+const pn_entry * pn_table::probe(uint64_t key) const{
+    const pn_entry * bucket = entries + (key & mask);
+    for (int i = 0; i < PN_BUCKET; i++){
+        if (bucket[i].work && bucket[i].key == key) return &bucket[i];
+    }
+    return nullptr;
+}
+
+/*
+Stores the numbers of a position. A full bucket gives up the entry with the least
+work under it, and a table that is nearly full is collected.
+*/
+void pn_table::store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work){
+    pn_entry * bucket = entries + (key & mask);
+    pn_entry * slot = nullptr;
+
+    for (int i = 0; i < PN_BUCKET && !slot; i++){
+        if (bucket[i].work && bucket[i].key == key) slot = &bucket[i];
+    }
+    for (int i = 0; i < PN_BUCKET && !slot; i++){
+        if (!bucket[i].work){
+            slot = &bucket[i];
+            used++;
+        }
+    }
+    if (!slot){
+        slot = bucket;
+        for (int i = 1; i < PN_BUCKET; i++){
+            if (bucket[i].work < slot->work) slot = &bucket[i];
+        }
+    }
+
+    slot->key = key;
+    slot->phi = phi;
+    slot->delta = delta;
+    slot->work = (uint32_t)std::min<uint64_t>(std::max<uint64_t>(work, 1), UINT32_MAX);
+
+    if (used > capacity * PN_GC_FILL) collect();
+}
+
+/*
+Garbage collection: drops the entries with the smallest subtrees under them, which
+are the cheapest to search again. Entries are grouped by the bit length of their
+work, and whole groups go, smallest first, until enough of the table is free.
+*/
+void pn_table::collect(){
+    size_t groups[33] = {};
+    for (size_t i = 0; i < capacity; i++){
+        if (entries[i].work) groups[32 - __builtin_clz(entries[i].work)]++;
+    }
+
+    const size_t target = capacity * (1 - PN_GC_FREE);
+    size_t left = used;
+    int drop = 0;
+    while (drop < 32 && left - groups[drop] > target) left -= groups[drop++];
+    left -= groups[drop];
+
+    for (size_t i = 0; i < capacity; i++){
+        if (entries[i].work && 32 - __builtin_clz(entries[i].work) <= drop) entries[i].work = 0;
+    }
+    used = left;
+    collections++;
+}
+
+pn_solver::pn_solver(size_t table_mb){
+    table.set_size(table_mb);
+    for (int i = 0; i < 2; i++) goal_salt[i] = rand64();
+    for (int i = 0; i <= DRAW_MOVE_RULE; i++) rule_salt[i] = rand64();
+}
+
+/*
+The multiple iterative deepening step of df-pn. Searches below the position until
+its proof number reaches th_phi or its disproof number reaches th_delta. The numbers
+of the moves are kept here while the position is searched, so that results from
+repetitions reach it without going through the table.
+
+@param ply
+   the distance from the position being solved
+@param goal
+   the goal of the side to move
+*/
+pn_solver::node_value pn_solver::mid(Board &board, int ply, int goal, uint32_t th_phi, uint32_t th_delta){
+    nodes++;
+
+    if (board.check_repetition()){
+        int depends_on = PN_NO_PLY;
+        if (board.reversible_moves < DRAW_MOVE_RULE){
+            depends_on = -1;
+            for (int i = board.reversible_moves - 2; i >= 0; i -= 2){
+                if (board.rep_stack[i] == board.hash_key){
+                    depends_on = ply - (board.reversible_moves - i);
+                    break;
+                }
+            }
+        }
+        if (goal == PN_WIN) return {PN_INF, 0, 1, depends_on};
+        return {0, PN_INF, 1, depends_on};
+    }
+
+    if (egdb_draw(board)){
+        egdb_draws++;
+        if (goal == PN_WIN) return {PN_INF, 0, 1, PN_NO_PLY};
+        return {0, PN_INF, 1, PN_NO_PLY};
+    }
+
+    Move moves[MAX_MOVES];
+    const int count = board.gen_moves(moves, (char)-1);
+    if (!count) return {PN_INF, 0, 1, PN_NO_PLY};
+
+    const uint64_t node_key = key(board, goal);
+    const uint64_t start = nodes;
+    uint64_t work = 0;
+
+    const pn_entry * entry = table.probe(node_key);
+    if (entry){
+        if (!entry->phi || !entry->delta) return {entry->phi, entry->delta, entry->work, PN_NO_PLY};
+        work = entry->work;
+    }
+
+    node_value children[MAX_MOVES];
+    for (int i = 0; i < count; i++){
+        entry = table.probe(child_key(board, moves[i], !goal));
+        if (entry) children[i] = {entry->phi, entry->delta, entry->work, PN_NO_PLY};
+        else       children[i] = {1, 1, 0, PN_NO_PLY};
+    }
+
+    uint32_t phi, delta;
+    while (true){
+        /* phi is the least disproof number of a move and delta the sum of their proof numbers */
+        uint64_t sum = 0;
+        uint32_t second = PN_INF;
+        int best = 0;
+        phi = PN_INF;
+        for (int i = 0; i < count; i++){
+            if (children[i].delta < phi){
+                second = phi;
+                phi = children[i].delta;
+                best = i;
+            }
+            else if (children[i].delta < second){
+                second = children[i].delta;
+            }
+            sum += children[i].phi;
+        }
+        delta = (uint32_t)std::min<uint64_t>(sum, PN_INF);
+
+        if (phi >= th_phi || delta >= th_delta || nodes >= node_limit) break;
+
+        const uint32_t child_phi = (uint32_t)std::min<uint64_t>((uint64_t)th_delta - delta + children[best].phi, PN_INF);
+        const uint32_t child_delta = std::min(th_phi, second + 1);
+
+        const uint32_t prev_kings = board.bb.kings;
+        board.push_move(moves[best]);
+        children[best] = mid(board, ply + 1, !goal, child_phi, child_delta);
+        board.undo(moves[best], prev_kings);
+    }
+
+    /* A proof needs one move that disproves the opponent's goal, a disproof needs all of them */
+    int depends_on = PN_NO_PLY;
+    if (!phi){
+        depends_on = -1;
+        for (int i = 0; i < count; i++){
+            if (!children[i].delta) depends_on = std::max(depends_on, children[i].depends_on);
+        }
+    }
+    else if (!delta){
+        for (int i = 0; i < count; i++) depends_on = std::min(depends_on, children[i].depends_on);
+    }
+
+    work += nodes - start;
+    if (depends_on >= ply) table.store(node_key, phi, delta, work);
+    return {phi, delta, work, depends_on};
+}
+
+/* Searches until the goal is proven or disproven, or the node limit is reached */
+pn_solver::node_value pn_solver::prove(Board &board, int ply, int goal){
+    node_value value;
+    do {
+        value = mid(board, ply, goal, PN_INF, PN_INF);
+    } while (!value.final() && nodes < node_limit);
+    return value;
+}
+
+/*
+Follows the proof from the position to the end of the game, or to a database draw.
+Where the goal of the side to move is proven, the line takes the move with the
+smallest proof under it; where it is disproven, every move fails, and the line
+takes the one that holds out the longest.
+
+@param proven
+   whether the goal of the side to move is proven or disproven
+*/
+void pn_solver::find_line(Board board, int goal, bool proven){
+    Move moves[MAX_MOVES];
+    int count;
+
+    while (line.size() < PN_MAX_LINE && !board.check_repetition() && !egdb_draw(board) && (count = board.gen_moves(moves, (char)-1))){
+        int best = -1;
+        uint64_t best_work = 0;
+
+        if (proven){
+            for (int i = 0; i < count; i++){
+                const uint32_t prev_kings = board.bb.kings;
+                board.push_move(moves[i]);
+                const pn_entry * entry = board.check_repetition() ? nullptr : table.probe(key(board, !goal));
+                const bool found = entry && !entry->delta;
+                board.undo(moves[i], prev_kings);
+
+                if (found && (best < 0 || entry->work < best_work)){
+                    best = i;
+                    best_work = entry->work;
+                }
+            }
+        }
+
+        /* Moves whose results weren't stored are searched again */
+        for (int i = 0; i < count && (best < 0 || !proven); i++){
+            const uint32_t prev_kings = board.bb.kings;
+            board.push_move(moves[i]);
+            node_value value = prove(board, line.size() + 1, !goal);
+            board.undo(moves[i], prev_kings);
+
+            if (!value.final()) return;
+            if (proven ? !value.delta : (best < 0 || value.work > best_work)){
+                best = i;
+                best_work = value.work;
+            }
+        }
+        if (best < 0) return;
+
+        board.push_move(moves[best]);
+        line.push_back(moves[best]);
+        goal = !goal;
+        proven = !proven;
+    }
+}
+
+/*
+Solves the position for the side to move: first whether it wins, and if it
+doesn't, whether it draws. The position is taken to have no moves before it.
+
+@param limit
+   the most nodes to search, not counting the search for the line
+*/
+pn_result pn_solver::solve(Board board, uint64_t limit){
+    line.clear();
+    node_limit = nodes + limit;
+    board.rep_stack[board.reversible_moves] = board.hash_key;
+
+    node_value win = prove(board, 0, PN_WIN);
+    if (!win.final()) return PN_UNKNOWN;
+
+    pn_result result = PN_PROVEN_WIN;
+    int goal = PN_WIN;
+    bool proven = true;
+
+    if (win.phi){
+        node_value draw = prove(board, 0, PN_NOT_LOSE);
+        if (!draw.final()) return PN_UNKNOWN;
+
+        result = draw.phi ? PN_PROVEN_LOSS : PN_PROVEN_DRAW;
+        goal = PN_NOT_LOSE;
+        proven = !draw.phi;
+    }
+
+    node_limit = nodes + limit;
+    find_line(board, goal, proven);
+    return result;
+}
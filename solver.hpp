@@ -0,0 +1,128 @@
+#pragma once
+
+#include "board.hpp"
+#include "egdb.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+/*
+Proves positions won, lost or drawn with depth first proof number search (df-pn).
+
+Each search proves or disproves one goal for the side to move: a win, or at least
+a draw. A position meets a goal if one of its moves leads to a position where the
+opponent fails the opposite goal, so the goal flips from one ply to the next and
+every node can be written from the side to move's point of view: phi is the
+proof number of its goal and delta the disproof number.
+
+The transposition table keys include the goal and the number of reversible moves,
+which makes the move rule part of the position. Draws by repetition depend on the
+path instead. A repetition of a position inside the subtree of a node is a loop
+that the side it helps can keep forcing until the move rule draws the game, so it
+doesn't change the result of the node, but a repetition of a position above it
+does. Results that rest on one of those are passed up the tree but not stored.
+
+Drawn positions take a search of every way to play the reversible moves the move
+rule allows, so the endgame databases are used for them when they are loaded. A
+database draw can't be won even without the move rule, so it is a draw here too.
+Database wins may take longer than the move rule allows and are searched.
+*/
+#define PN_INF        2000000000u
+#define PN_MAX_LINE   200
+#define PN_TABLE_MB   256
+#define PN_NO_PLY     1000000
+
+/* A full table drops its smallest subtrees until this fraction of it is free */
+#define PN_GC_FILL    0.9
+#define PN_GC_FREE    0.5
+
+enum pn_goal {
+    PN_WIN,
+    PN_NOT_LOSE
+};
+
+enum pn_result {
+    PN_UNKNOWN,
+    PN_PROVEN_WIN,
+    PN_PROVEN_DRAW,
+    PN_PROVEN_LOSS
+};
+
+struct pn_entry{
+    uint64_t key;
+    uint32_t phi;
+    uint32_t delta;
+    uint32_t work;    // nodes searched below the position, 0 for an empty entry
+    uint32_t unused;
+};
+
+#define PN_BUCKET 4
+
+class pn_table{
+    public:
+        ~pn_table() { free(entries); }
+
+        void set_size(size_t mb);
+        void clear();
+        const pn_entry * probe(uint64_t key) const;
+        void store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work);
+
+        size_t used = 0;
+        size_t capacity = 0;
+        int collections = 0;
+
+    private:
+        pn_entry * entries = nullptr;
+        size_t mask = 0;  // of the first entry of a bucket
+
+        void collect();
+};
+
+/* The number of reversible moves played after the move */
+inline int pn_reversible_moves(const Board &board, const Move &move){
+    return (move.piecetype <= WHITE_PIECE || move.taken_bb) ? 0 : board.reversible_moves + 1;
+}
+
+class pn_solver{
+    public:
+        pn_solver(size_t table_mb = PN_TABLE_MB);
+
+        pn_result solve(Board board, uint64_t node_limit);
+
+        /* The moves from the solved position that the result rests on */
+        std::vector<Move> line;
+        uint64_t nodes = 0;
+        uint64_t egdb_draws = 0;
+        pn_table table;
+
+    private:
+        struct node_value{
+            uint32_t phi;
+            uint32_t delta;
+            uint64_t work;
+            int depends_on;  // the ply of the earliest position whose repetition the result rests on
+
+            inline bool final() const { return !phi || !delta; }
+        };
+
+        uint64_t goal_salt[2];
+        uint64_t rule_salt[DRAW_MOVE_RULE + 1];
+        uint64_t node_limit = 0;
+
+        inline uint64_t key(const Board &board, int goal) const{
+            return board.hash_key ^ goal_salt[goal] ^ rule_salt[board.reversible_moves];
+        }
+
+        inline uint64_t child_key(const Board &board, const Move &move, int goal) const{
+            return board.child_key(move) ^ goal_salt[goal] ^ rule_salt[pn_reversible_moves(board, move)];
+        }
+
+        inline bool egdb_draw(const Board &board) const{
+            return board.piece_count[BLACK] + board.piece_count[WHITE] <= egdb.pieces() && egdb.probe(board.bb) == EGDB_DRAW;
+        }
+
+        node_value mid(Board &board, int ply, int goal, uint32_t th_phi, uint32_t th_delta);
+        node_value prove(Board &board, int ply, int goal);
+        void find_line(Board board, int goal, bool proven);
+};
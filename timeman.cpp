@@ -0,0 +1,93 @@
+#include "timeman.hpp"
+
+#include <algorithm>
+
+/* Time kept back for move overhead, in milliseconds */
+const uint64_t MOVE_OVERHEAD = 30;
+
+/* Moves we expect to still play when the clock has no moves to go */
+const int EXPECTED_MOVES = 30;
+
+/*
+Sets the limits from the remaining time on the clock. The planned time is an
+even share of the clock plus most of the increment, and the hard limit allows
+a few times that, without ever touching the reserve.
+*/
+void time_manager::init_clock(const game_clock &clock){
+    start = get_time();
+    use_prediction = true;
+    instability = 1;
+    last_iteration = prev_iteration = 0;
+
+    uint64_t usable = (clock.remaining > MOVE_OVERHEAD) ? clock.remaining - MOVE_OVERHEAD : 1;
+    int moves = clock.moves_to_go ? std::min(clock.moves_to_go, EXPECTED_MOVES) : EXPECTED_MOVES;
+
+    optimum = usable / moves + clock.increment * 3 / 4;
+    hard_limit = std::min(optimum * 5, (moves == 1) ? usable * 9 / 10 : usable / 3);
+    hard_limit = std::max(hard_limit, (uint64_t)1);
+    optimum = std::min(optimum, hard_limit);
+    soft_limit = optimum;
+}
+
+/* Searches for exactly the given number of milliseconds */
+void time_manager::init_movetime(uint64_t movetime){
+    start = get_time();
+    use_prediction = false;
+    instability = 1;
+    last_iteration = prev_iteration = 0;
+
+    optimum = soft_limit = hard_limit = movetime;
+}
+
+/* Searches until stopped by something other than time */
+void time_manager::init_infinite(){
+    init_movetime(UINT64_MAX / 2);
+}
+
+void time_manager::iteration_started(){
+    iteration_start = get_time();
+}
+
+/*
+Called after each completed iteration.
+
+@param best_changed
+   whether the iteration changed the best move
+@param score_drop
+   how much worse the score got compared to the previous iteration
+*/
+void time_manager::iteration_finished(bool best_changed, int score_drop){
+    prev_iteration = last_iteration;
+    last_iteration = get_time() - iteration_start;
+
+    /* A changing best move is a sign that more time will pay off, a stable one lets it decay */
+    if (best_changed) instability = std::min(instability * 1.4, 2.5);
+    else              instability = std::max(instability * 0.9, 1.0);
+
+    update_soft_limit(score_drop);
+}
+
+void time_manager::update_soft_limit(int score_drop){
+    double scale = instability;
+    if      (score_drop > 60) scale *= 2;
+    else if (score_drop > 30) scale *= 1.5;
+
+    double limit = optimum * scale;
+    soft_limit = (limit >= hard_limit) ? hard_limit : (uint64_t)limit;
+}
+
+/*
+Checks whether there is time for another iteration. When clock based, the
+length of the next iteration is predicted from the growth of the last two,
+and it is not started if it would likely be cut off by the hard limit.
+*/
+bool time_manager::can_start_iteration() const{
+    uint64_t used = elapsed();
+    if (used >= soft_limit) return false;
+    if (!use_prediction || !last_iteration) return true;
+
+    double growth = prev_iteration ? (double)last_iteration / prev_iteration : 3;
+    growth = std::max(1.5, std::min(growth, 4.0));
+
+    return used + (uint64_t)(last_iteration * growth) <= hard_limit;
+}
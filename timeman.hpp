@@ -0,0 +1,47 @@
+#pragma once
+
+#include "misc.hpp"
+
+#include <cstdint>
+
+/* How much time is left on a player's clock, in milliseconds */
+struct game_clock{
+    uint64_t remaining = 0;
+    uint64_t increment = 0;
+    int moves_to_go = 0; // Moves until the next time control, 0 for sudden death
+};
+
+/*
+Decides how long a search may run. The soft limit is checked between iterations
+and grows when the search looks unstable, the hard limit aborts the search.
+*/
+struct time_manager{
+    uint64_t start = 0;
+    uint64_t optimum = 0;    // Planned time for this move
+    uint64_t soft_limit = 0; // No new iterations are started after this
+    uint64_t hard_limit = 0; // The search is cancelled after this
+    bool use_prediction = false;
+
+    void init_clock(const game_clock &clock);
+    void init_movetime(uint64_t movetime);
+    void init_infinite();
+
+    void iteration_started();
+    void iteration_finished(bool best_changed, int score_drop);
+    bool can_start_iteration() const;
+
+    inline uint64_t elapsed() const {
+        return get_time() - start;
+    }
+    inline bool out_of_time() const {
+        return elapsed() > hard_limit;
+    }
+
+    private:
+        uint64_t iteration_start = 0;
+        uint64_t last_iteration = 0;
+        uint64_t prev_iteration = 0;
+        double instability = 1;
+
+        void update_soft_limit(int score_drop);
+};
@@ -0,0 +1,69 @@
+#include "training.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+chunk_writer::chunk_writer(const std::string &prefix, uint64_t chunk_size) : prefix(prefix), chunk_size(std::max<uint64_t>(chunk_size, 1)) {}
+
+chunk_writer::~chunk_writer(){
+    if (file) fclose(file);
+}
+
+/* Closes the current file and opens the one after it */
+bool chunk_writer::next_chunk(){
+    if (file){
+        fclose(file);
+        chunk++;
+    }
+    std::string path = prefix + "_" + std::to_string(chunk) + ".bin";
+    file = fopen(path.c_str(), "wb");
+    in_chunk = 0;
+    if (!file) std::cout << "could not open " << path << "\n";
+    return file != nullptr;
+}
+
+/*
+Appends a batch of positions, starting a new file first if the batch doesn't
+fit in what is left of the current one.
+
+@return
+   false if a file couldn't be opened or written
+*/
+bool chunk_writer::write(const std::vector<packed_position> &batch){
+    std::lock_guard<std::mutex> guard(lock);
+    size_t done = 0;
+
+    while (done < batch.size()){
+        if (!file || (in_chunk && in_chunk + (batch.size() - done) > chunk_size) || in_chunk == chunk_size){
+            if (!next_chunk()) return false;
+        }
+        size_t count = std::min<uint64_t>(batch.size() - done, chunk_size - in_chunk);
+        if (fwrite(&batch[done], sizeof(packed_position), count, file) != count) return false;
+        done += count;
+        in_chunk += count;
+        written += count;
+    }
+    return true;
+}
+
+/*
+Appends the positions of a file written by chunk_writer.
+
+@return
+   false if the file couldn't be read, or ends partway through a position
+*/
+bool read_positions(const std::string &path, std::vector<packed_position> &positions){
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    packed_position buffer[4096];
+    size_t count;
+    size_t bytes = 0;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0){
+        positions.insert(positions.end(), buffer, buffer + count / sizeof(packed_position));
+        bytes += count;
+        if (count % sizeof(packed_position)) break;
+    }
+    fclose(file);
+    return bytes % sizeof(packed_position) == 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "board.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+A labelled position as datagen writes it and tune reads it. Files are plain
+arrays of these, little endian and without a header.
+*/
+struct packed_position{
+    uint32_t pieces[2];
+    uint32_t kings;
+    int16_t score;   // search score from the point of view of the side to move
+    uint8_t stm;
+    uint8_t result;  // of the game: 2 if black won, 1 for a draw, 0 if white won
+
+    inline Bitboards bitboards() const { return {{pieces[BLACK], pieces[WHITE]}, kings, stm}; }
+
+    /* The result from black's point of view, as a score from 0 to 1 */
+    inline float black_result() const { return result * 0.5f; }
+};
+static_assert(sizeof(packed_position) == 16, "packed_position is written to disk as is");
+
+/*
+Writes positions from any number of threads into numbered files of at most
+chunk_size positions each: prefix_0.bin, prefix_1.bin and so on. Threads
+hand over whole batches, so a batch (a game) never goes to more than one
+file unless it is larger than a chunk.
+*/
+class chunk_writer{
+    public:
+        chunk_writer(const std::string &prefix, uint64_t chunk_size);
+        ~chunk_writer();
+
+        bool write(const std::vector<packed_position> &batch);
+        uint64_t total() const { return written; }
+        int chunks() const { return chunk + (file != nullptr); }
+
+    private:
+        std::mutex lock;
+        std::string prefix;
+        uint64_t chunk_size;
+        uint64_t in_chunk = 0;
+        uint64_t written = 0;
+        int chunk = 0;
+        FILE * file = nullptr;
+
+        bool next_chunk();
+};
+
+bool read_positions(const std::string &path, std::vector<packed_position> &positions);
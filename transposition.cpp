@@ -2,6 +2,8 @@
 
 #include "cpu.hpp"
 
+#include <cstring>
+
 hash_func hash;
 
 uint64_t rand64() {
@@ -30,7 +32,8 @@ be called ONE TIME per transposition table otherwise I'm
 pretty sure it causes a memory leak.
 */
 int tt_table::set_size(int size) {
-    free(tt);
+    if (owner) free(tt);
+    owner = true;
     if (size & (size - 1)){
         size--;
         for (int i = 1; i < 32; i=i*2){
@@ -46,15 +49,31 @@ int tt_table::set_size(int size) {
 
     tt_size = (size / sizeof(tt_entry)) - 1;
     tt = (tt_entry *) malloc(size);
+    clear();
 
     return 0;
 }
 
+/* Uses the entries of another table, so that several searches fill and read the same table */
+void tt_table::share(const tt_table &other) {
+    if (owner) free(tt);
+    tt = other.tt;
+    tt_size = other.tt_size;
+    owner = false;
+}
+
+/* Empties the table, so that searches don't depend on what was searched before */
+void tt_table::clear() {
+    if (tt_size) memset(tt, 0, (tt_size + 1) * sizeof(tt_entry));
+    num_entries = 0;
+    fails = 0;
+}
+
 /*
 Checks if a position is already tracked in the table. If the position is there, and its
 depth is sufficient, return the value that is saved. Otherwise, return INVALID.
 */
-int tt_table::probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, char * best) {
+int tt_table::probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, packed_move * best) {
     if (!tt_size) return INVALID;
 
     /*
@@ -65,7 +84,7 @@ int tt_table::probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, char
     tt_entry * phashe = &tt[boardhash & tt_size];
 
     /* Checks if the key we have matches the one at the index we calculated */
-    if (phashe->hash == boardhash){
+    if (phashe->key == (uint32_t)(boardhash >> 32)){
         *best = phashe->bestmove;
 
         /*
@@ -88,7 +107,7 @@ int tt_table::probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, char
 }
 
 /* Saves an entry into the table. Generally this will overwrite any old data. */
-void tt_table::save(uint64_t boardhash, uint8_t depth, int ply, int val, char flags, uint8_t best){
+void tt_table::save(uint64_t boardhash, uint8_t depth, int ply, int val, char flags, packed_move best){
     if (!tt_size) return;
 
     tt_entry * phashe = &tt[boardhash & tt_size];
@@ -97,7 +116,10 @@ void tt_table::save(uint64_t boardhash, uint8_t depth, int ply, int val, char fl
     The only case where we don't overwrite is if we are trying to save 
     a position that has already been searched at a greater depth.
     */
-    if ( (phashe->hash == boardhash) && (phashe->depth > depth) ) return;
+    if ( (phashe->key == (uint32_t)(boardhash >> 32)) && (phashe->depth > depth) ) return;
+
+    /* Quiescence results are cheap to redo, so they never push out the result of a real search */
+    if (!depth && phashe->depth) return;
 
     /*
     Adjusts the score of winning positions to represent the win distance
@@ -107,7 +129,7 @@ void tt_table::save(uint64_t boardhash, uint8_t depth, int ply, int val, char fl
         if (val > 0) val += ply;
         else         val -= ply;
     }
-    phashe->hash = boardhash;
+    phashe->key = boardhash >> 32;
     phashe->val = val;
     phashe->flags = flags;
     phashe->depth = depth;
@@ -131,10 +153,15 @@ int tt_eval_table::set_size(int size){
 
     ett_size = (size / sizeof(tt_eval_entry)) - 1;
     ett = (tt_eval_entry *) malloc(size);
+    clear();
 
     return 0; 
 }
 
+void tt_eval_table::clear(){
+    if (ett_size) memset(ett, 0, (ett_size + 1) * sizeof(tt_eval_entry));
+}
+
 int tt_eval_table::probe(uint64_t boardHash){
     if (!ett_size) return INVALID;
 
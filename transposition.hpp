@@ -18,25 +18,32 @@ enum ettflag{
     TT_BETA
 };
 
+/*
+The low bits of the hash pick the slot, so only the high half is kept
+to check that the entry belongs to the position.
+*/
 struct tt_entry{
-    uint64_t hash;
-    int val;
+    uint32_t key;
+    int16_t val;
     uint8_t depth;
     uint8_t flags;
-    uint8_t bestmove;
+    packed_move bestmove;
 };
 
 struct tt_table{
-    tt_entry * tt;
-    int tt_size;
+    tt_entry * tt = nullptr;
+    int tt_size = 0;
     int num_entries = 0;
     int fails = 0;
+    bool owner = true; // false when the entries belong to another table
 
     int set_size(int size);
-    int probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, char * best);
-    void save(uint64_t boardhash, uint8_t depth, int ply, int val, char flags, uint8_t best);
+    void share(const tt_table &other);
+    void clear();
+    int probe(uint64_t boardhash, uint8_t depth, int alpha, int beta, packed_move * best);
+    void save(uint64_t boardhash, uint8_t depth, int ply, int val, char flags, packed_move best);
     ~tt_table() {
-        free(tt);
+        if (owner) free(tt);
     }
 };
 
@@ -46,10 +53,11 @@ struct tt_eval_entry{
 };
 
 struct tt_eval_table{
-    tt_eval_entry * ett;
-    int ett_size;
+    tt_eval_entry * ett = nullptr;
+    int ett_size = 0;
     
     int set_size(int size);
+    void clear();
     int probe(uint64_t boardHash);
     void save(uint64_t boardHash, int val);
     ~tt_eval_table() {
@@ -0,0 +1,274 @@
+#include "cpu.hpp"
+#include "board.hpp"
+#include "training.hpp"
+#include "transposition.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Texel style tuning of the handcrafted eval. Every weight multiplies a term that
+doesn't depend on the weights, so the terms of each position are computed once
+when it is loaded, and the eval of a position is a dot product after that:
+
+   eval = sum(weight[i] * term[i]) + runaway distances
+
+The error is the mean squared difference between the game result and the result
+the eval predicts, sigmoid(K * eval). K is fitted first with the current weights,
+which fixes the scale of the eval, then all weights move together by gradient
+descent. The work of each pass over the positions is split between threads.
+*/
+
+const int TERM_COUNT = 6;
+
+/* The weights in the order of the terms */
+int eval_weights::* const TERMS[TERM_COUNT] = {
+    &eval_weights::man, &eval_weights::king, &eval_weights::king_center,
+    &eval_weights::king_edge, &eval_weights::mobility, &eval_weights::runaway
+};
+const char * TERM_NAMES[TERM_COUNT] = {"man", "king", "king_center", "king_edge", "mobility", "runaway"};
+
+struct tune_position{
+    int8_t terms[TERM_COUNT];
+    int8_t distance; // what the runaway term adds besides its weight
+    float result;    // 1 if black won, 0.5 for a draw, 0 if white won
+};
+
+/*
+Splits the eval of a position into its terms, from black's point of view. The
+position must be quiet: the eval is never used when there is a capture.
+*/
+tune_position make_position(const Bitboards &bb, float result){
+    const uint32_t black_kings = bb.pieces[BLACK] & bb.kings;
+    const uint32_t white_kings = bb.pieces[WHITE] & bb.kings;
+    tune_position p;
+
+    p.terms[0] = count_bits(bb.pieces[BLACK] & ~bb.kings) - count_bits(bb.pieces[WHITE] & ~bb.kings);
+    p.terms[1] = count_bits(black_kings) - count_bits(white_kings);
+    p.terms[2] = count_bits(black_kings & CENTER_8) - count_bits(white_kings & CENTER_8);
+    p.terms[3] = count_bits(white_kings & SINGLE_EDGE) - count_bits(black_kings & SINGLE_EDGE);
+    p.terms[4] = cpu::mobility_count(bb);
+
+    /* past_pawns is linear in the runaway weight */
+    p.distance = cpu::past_pawns(bb, 0);
+    p.terms[5] = cpu::past_pawns(bb, 1) - p.distance;
+    p.result = result;
+    return p;
+}
+
+/*
+Reads positions into the list, skipping those where the side to move can capture.
+Files ending in .bin are packed positions written by datagen. Other files have
+one position per line: the black, white and king bitboards in hex, the side to
+move, and the result of the game from black's point of view (1, 0.5 or 0).
+
+@return
+   false if the file couldn't be read
+*/
+bool load_positions(const std::string &path, std::vector<tune_position> &positions){
+    int skipped = 0, bad = 0;
+    size_t before = positions.size();
+
+    auto add = [&](const Bitboards &bb, float result){
+        if (bb.stm ? bb.get_white_jumpers() : bb.get_black_jumpers()) skipped++;
+        else positions.push_back(make_position(bb, result));
+    };
+
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0){
+        std::vector<packed_position> packed;
+        if (!read_positions(path, packed)) return false;
+        for (const packed_position &p : packed) add(p.bitboards(), p.black_result());
+    }
+    else{
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::string line;
+        while (std::getline(file, line)){
+            Bitboards bb;
+            unsigned int black, white, kings, stm;
+            float result;
+            if (sscanf(line.c_str(), "%x %x %x %u %f", &black, &white, &kings, &stm, &result) != 5 || stm > 1){
+                bad++;
+                continue;
+            }
+            bb.pieces[BLACK] = black;
+            bb.pieces[WHITE] = white;
+            bb.kings = kings;
+            bb.stm = stm;
+            add(bb, result);
+        }
+    }
+
+    std::cout << path << ": " << positions.size() - before << " positions, " << skipped << " skipped with captures";
+    if (bad) std::cout << ", " << bad << " unreadable lines";
+    std::cout << "\n";
+    return true;
+}
+
+struct tuner{
+    const std::vector<tune_position> &positions;
+    int threads;
+    double k = 0;
+
+    tuner(const std::vector<tune_position> &positions, int threads) : positions(positions), threads(threads) {}
+
+    static inline double eval(const tune_position &p, const double * w){
+        double result = p.distance;
+        for (int i = 0; i < TERM_COUNT; i++) result += w[i] * p.terms[i];
+        return result;
+    }
+    static inline double sigmoid(double x){
+        return 1 / (1 + exp(-x));
+    }
+
+    /*
+    Runs a pass over the positions. Each thread sums the error, and the gradient of the
+    error if one is asked for, over its share of the positions.
+
+    @return
+       the mean squared error
+    */
+    double pass(const double * w, double * gradient){
+        std::vector<double> errors(threads, 0);
+        std::vector<std::vector<double>> gradients(threads, std::vector<double>(TERM_COUNT, 0));
+        std::vector<std::thread> workers;
+
+        for (int t = 0; t < threads; t++){
+            workers.emplace_back([&, t](){
+                size_t begin = positions.size() * t / threads;
+                size_t end = positions.size() * (t + 1) / threads;
+                double error = 0;
+                double grad[TERM_COUNT] = {};
+
+                for (size_t n = begin; n < end; n++){
+                    const tune_position &p = positions[n];
+                    double predicted = sigmoid(k * eval(p, w));
+                    double diff = predicted - p.result;
+                    error += diff * diff;
+
+                    if (gradient){
+                        double scale = diff * predicted * (1 - predicted);
+                        for (int i = 0; i < TERM_COUNT; i++) grad[i] += scale * p.terms[i];
+                    }
+                }
+                errors[t] = error;
+                for (int i = 0; i < TERM_COUNT; i++) gradients[t][i] = grad[i];
+            });
+        }
+        for (std::thread &worker : workers) worker.join();
+
+        double error = 0;
+        for (int t = 0; t < threads; t++) error += errors[t];
+        if (gradient){
+            for (int i = 0; i < TERM_COUNT; i++){
+                gradient[i] = 0;
+                for (int t = 0; t < threads; t++) gradient[i] += gradients[t][i];
+                gradient[i] *= 2 * k / positions.size();
+            }
+        }
+        return error / positions.size();
+    }
+
+    /* Finds the K with the least error by golden section search */
+    void fit_k(const double * w){
+        const double ratio = (sqrt(5) - 1) / 2;
+        double low = 0, high = 0.1;
+        for (int i = 0; i < 40; i++){
+            double a = high - ratio * (high - low);
+            double b = low + ratio * (high - low);
+            k = a;
+            double error_a = pass(w, nullptr);
+            k = b;
+            double error_b = pass(w, nullptr);
+            if (error_a < error_b) high = b;
+            else                   low = a;
+        }
+        k = (low + high) / 2;
+    }
+
+    /* Adam: each weight takes steps of about the learning rate, scaled by how steady its gradient is */
+    void descend(double * w, int epochs, double rate){
+        const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-12;
+        double m[TERM_COUNT] = {}, v[TERM_COUNT] = {};
+        double gradient[TERM_COUNT];
+
+        for (int epoch = 1; epoch <= epochs; epoch++){
+            double error = pass(w, gradient);
+            for (int i = 0; i < TERM_COUNT; i++){
+                m[i] = beta1 * m[i] + (1 - beta1) * gradient[i];
+                v[i] = beta2 * v[i] + (1 - beta2) * gradient[i] * gradient[i];
+                double m_hat = m[i] / (1 - pow(beta1, epoch));
+                double v_hat = v[i] / (1 - pow(beta2, epoch));
+                w[i] -= rate * m_hat / (sqrt(v_hat) + epsilon);
+            }
+
+            if (epoch % 100 == 0 || epoch == epochs){
+                std::cout << "epoch " << epoch << ", error " << error << ":";
+                for (int i = 0; i < TERM_COUNT; i++) std::cout << " " << TERM_NAMES[i] << "=" << w[i];
+                std::cout << "\n";
+            }
+        }
+    }
+};
+
+int main(){
+    set_hash_function();
+    weights.load(WEIGHTS_FILE);
+
+    std::string paths, path, out_path;
+    int threads, epochs;
+    double rate;
+
+    std::cout << "positions files: ";
+    std::getline(std::cin, paths);
+    std::cout << "threads (0 for all cores): ";
+    std::cin >> threads;
+    std::cout << "epochs: ";
+    std::cin >> epochs;
+    std::cout << "learning rate: ";
+    std::cin >> rate;
+    std::cout << "write weights to: ";
+    std::cin >> out_path;
+    std::cout << "\n";
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    uint64_t start = get_time();
+    std::vector<tune_position> positions;
+    std::istringstream path_stream(paths);
+    while (path_stream >> path){
+        if (!load_positions(path, positions)) std::cout << "could not read " << path << "\n";
+    }
+    if (positions.empty()) return 1;
+    std::cout << "loaded in " << get_time() - start << " ms\n";
+
+    double w[TERM_COUNT];
+    for (int i = 0; i < TERM_COUNT; i++) w[i] = weights.*TERMS[i];
+
+    tuner t(positions, threads);
+    start = get_time();
+    t.fit_k(w);
+    std::cout << "K = " << t.k << ", error " << t.pass(w, nullptr) << " with the current weights\n";
+
+    t.descend(w, epochs, rate);
+    uint64_t elapsed = get_time() - start;
+    std::cout << "tuned in " << elapsed << " ms";
+    if (elapsed) std::cout << ", " << (double)positions.size() * (epochs + 81) / elapsed / 1000 << " M positions/s";
+    std::cout << "\n\n";
+
+    eval_weights tuned = weights;
+    for (int i = 0; i < TERM_COUNT; i++) tuned.*TERMS[i] = (int)lround(w[i]);
+    tuned.print();
+    if (!tuned.save(out_path.c_str())){
+        std::cout << "could not write " << out_path << "\n";
+        return 1;
+    }
+    std::cout << "wrote " << out_path << "\n";
+}